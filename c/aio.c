@@ -0,0 +1,368 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+/* linux/fs.h também define BLOCK_SIZE; vale o do sistema de arquivos */
+#undef BLOCK_SIZE
+#include "filesystem.h"
+#include "device.h"
+#include "aio.h"
+
+struct aio_req_s {
+    struct aio_batch_s *batch;
+    void (*done)(void *arg);
+    void *arg;
+    int writing;
+    struct iovec iov;
+    uint64_t offset;
+    struct aio_req_s *next;
+};
+
+/* Anel do io_uring, usado sem liburing: só as chamadas de sistema */
+static struct {
+    int fd;
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+} ring = { .fd = -1 };
+
+struct aio_stats_s aio_stats;
+
+static pthread_once_t aio_once = PTHREAD_ONCE_INIT;
+static int use_pool = 0;
+static int pool_started = 0;
+
+/* Pedidos em voo (limitados pelo anel), a fila do grupo de threads e as conclusões */
+static pthread_mutex_t aio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_free = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t work_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static uint32_t in_flight = 0;
+static struct aio_req_s *work_head = NULL, *work_tail = NULL;
+
+static void complete(struct aio_req_s *req, int result) {
+    uint32_t got = result > 0 ? result : 0;
+
+    if (got < req->iov.iov_len) {
+        if (req->writing) {
+            printf("Erro: Falha na escrita da imagem (offset %llu).\n", (unsigned long long)req->offset);
+        } else {
+            /* Como dev_pread: o que passa do fim da imagem lê como zero */
+            memset((uint8_t *)req->iov.iov_base + got, 0, req->iov.iov_len - got);
+        }
+    }
+
+    if (req->done) req->done(req->arg);
+
+    pthread_mutex_lock(&aio_lock);
+    in_flight--;
+    if (req->batch) atomic_fetch_sub(&req->batch->pending, 1);
+    pthread_cond_signal(&slot_free);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&aio_lock);
+    free(req);
+}
+
+/* Cada io_uring_enter conta como chamada ao sistema da camada de dispositivo */
+static void ring_enter(unsigned submit, unsigned wait, unsigned flags) {
+    atomic_fetch_add(&dev_stats.ring_enters, 1);
+    syscall(__NR_io_uring_enter, ring.fd, submit, wait, flags, NULL, 0);
+}
+
+static void *completion_thread(void *unused) {
+    (void)unused;
+
+    while (1) {
+        ring_enter(0, 1, IORING_ENTER_GETEVENTS);
+
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            struct aio_req_s *req = (struct aio_req_s *)(uintptr_t)cqe->user_data;
+            int result = cqe->res;
+
+            head++;
+            __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+            /* O grupo de threads conta em dev_pread/dev_pwrite; o anel, aqui */
+            if (result > 0) {
+                atomic_fetch_add(req->writing ? &dev_stats.bytes_written : &dev_stats.bytes_read, result);
+            }
+            complete(req, result);
+        }
+    }
+    return NULL;
+}
+
+static int ring_map(const struct io_uring_params *params) {
+    uint8_t *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size;
+
+    sq_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    cq_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_size > sq_size) sq_size = cq_size;
+    }
+
+    sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return -1;
+    cq_ptr = sq_ptr;
+    if (!(params->features & IORING_FEAT_SINGLE_MMAP)) {
+        cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) return -1;
+    }
+    ring.sqes = mmap(NULL, params->sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) return -1;
+
+    ring.sq_tail = (unsigned *)(sq_ptr + params->sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq_ptr + params->sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq_ptr + params->sq_off.array);
+    ring.cq_head = (unsigned *)(cq_ptr + params->cq_off.head);
+    ring.cq_tail = (unsigned *)(cq_ptr + params->cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq_ptr + params->cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq_ptr + params->cq_off.cqes);
+    return 0;
+}
+
+static int ring_setup() {
+    struct io_uring_params params;
+    pthread_t thread;
+
+    memset(&params, 0, sizeof(params));
+    ring.fd = syscall(__NR_io_uring_setup, AIO_QUEUE_DEPTH, &params);
+    if (ring.fd < 0) return -1;
+
+    if (ring_map(&params) == -1 || pthread_create(&thread, NULL, completion_thread, NULL) != 0) {
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+static void *pool_thread(void *unused) {
+    (void)unused;
+
+    while (1) {
+        struct aio_req_s *req;
+
+        pthread_mutex_lock(&aio_lock);
+        while (!work_head) {
+            pthread_cond_wait(&work_ready, &aio_lock);
+        }
+        req = work_head;
+        work_head = req->next;
+        if (!work_head) work_tail = NULL;
+        pthread_mutex_unlock(&aio_lock);
+
+        if (req->writing) dev_pwrite(req->iov.iov_base, req->iov.iov_len, req->offset);
+        else dev_pread(req->iov.iov_base, req->iov.iov_len, req->offset);
+        complete(req, req->iov.iov_len);
+    }
+    return NULL;
+}
+
+/* Chamar com aio_lock */
+static void pool_start() {
+    if (pool_started) return;
+    for (int i = 0; i < AIO_THREADS; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_thread, NULL) == 0) {
+            pthread_detach(thread);
+            pool_started = 1;
+        }
+    }
+}
+
+static void aio_init() {
+    if (ring_setup() == -1) use_pool = 1;
+}
+
+static struct aio_req_s *new_request(int writing, const void *buf, uint32_t length, uint64_t offset) {
+    struct aio_req_s *req = calloc(1, sizeof(struct aio_req_s));
+
+    if (!req) return NULL;
+    req->writing = writing;
+    req->iov.iov_base = (void *)buf;
+    req->iov.iov_len = length;
+    req->offset = offset;
+    return req;
+}
+
+/* Chamar com aio_lock: a entrada só vai ao kernel no próximo io_uring_enter */
+static void ring_push(struct aio_req_s *req) {
+    unsigned tail = *ring.sq_tail;
+    unsigned index = tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe = &ring.sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = req->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+    sqe->fd = dev_descriptor();
+    sqe->addr = (uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->off = req->offset;
+    sqe->user_data = (uintptr_t)req;
+    ring.sq_array[index] = index;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Entrega a lista de pedidos ao backend, respeitando a profundidade do anel */
+static void submit_list(struct aio_req_s *list) {
+    unsigned pushed = 0;
+
+    pthread_once(&aio_once, aio_init);
+
+    /* Com mmap (ou sem imagem) a cópia é imediata */
+    if (dev_descriptor() < 0) {
+        while (list) {
+            struct aio_req_s *req = list;
+            list = req->next;
+            pthread_mutex_lock(&aio_lock);
+            in_flight++;
+            pthread_mutex_unlock(&aio_lock);
+            if (req->writing) dev_pwrite(req->iov.iov_base, req->iov.iov_len, req->offset);
+            else dev_pread(req->iov.iov_base, req->iov.iov_len, req->offset);
+            complete(req, req->iov.iov_len);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&aio_lock);
+    aio_stats.batches++;
+    while (list) {
+        struct aio_req_s *req = list;
+        list = req->next;
+        req->next = NULL;
+
+        if (use_pool) {
+            pool_start();
+            if (work_tail) work_tail->next = req;
+            else work_head = req;
+            work_tail = req;
+        } else {
+            while (in_flight >= AIO_QUEUE_DEPTH) {
+                /* O que já está no anel precisa ir ao kernel antes de esperar */
+                if (pushed) ring_enter(pushed, 0, 0);
+                pushed = 0;
+                pthread_cond_wait(&slot_free, &aio_lock);
+            }
+            ring_push(req);
+            pushed++;
+        }
+
+        in_flight++;
+        aio_stats.requests++;
+        if (in_flight > aio_stats.max_in_flight) aio_stats.max_in_flight = in_flight;
+    }
+
+    if (use_pool) pthread_cond_broadcast(&work_ready);
+    else if (pushed) ring_enter(pushed, 0, 0);
+    pthread_mutex_unlock(&aio_lock);
+}
+
+static void enqueue(struct aio_batch_s *batch, int writing, const void *buf, uint32_t length, uint64_t offset) {
+    struct aio_req_s *req = new_request(writing, buf, length, offset);
+
+    if (!req) {
+        /* Sem memória para o pedido: faz a transferência na hora */
+        if (writing) dev_pwrite(buf, length, offset);
+        else dev_pread((void *)buf, length, offset);
+        return;
+    }
+
+    req->batch = batch;
+    req->next = batch->queued;
+    batch->queued = req;
+    atomic_fetch_add(&batch->pending, 1);
+}
+
+void aio_read(struct aio_batch_s *batch, void *buf, uint32_t length, uint64_t offset) {
+    enqueue(batch, 0, buf, length, offset);
+}
+
+void aio_write(struct aio_batch_s *batch, const void *buf, uint32_t length, uint64_t offset) {
+    enqueue(batch, 1, buf, length, offset);
+}
+
+/* Blocos adjacentes viram um só pedido, como em dev_read_blocks */
+void aio_read_blocks(struct aio_batch_s *batch, const uint32_t *blocks, uint32_t count, uint8_t *buf) {
+    for (uint32_t i = 0, run; i < count; i += run) {
+        run = dev_run_length(&blocks[i], count - i);
+        aio_read(batch, buf + (size_t)i * BLOCK_SIZE, run * BLOCK_SIZE, (uint64_t)blocks[i] * BLOCK_SIZE);
+    }
+}
+
+void aio_write_blocks(struct aio_batch_s *batch, const uint32_t *blocks, uint32_t count, const uint8_t *buf) {
+    for (uint32_t i = 0, run; i < count; i += run) {
+        run = dev_run_length(&blocks[i], count - i);
+        aio_write(batch, buf + (size_t)i * BLOCK_SIZE, run * BLOCK_SIZE, (uint64_t)blocks[i] * BLOCK_SIZE);
+    }
+}
+
+void aio_submit(struct aio_batch_s *batch) {
+    struct aio_req_s *list = batch->queued;
+
+    batch->queued = NULL;
+    if (list) submit_list(list);
+}
+
+void aio_wait(struct aio_batch_s *batch) {
+    aio_submit(batch);
+
+    pthread_mutex_lock(&aio_lock);
+    while (atomic_load(&batch->pending) > 0) {
+        pthread_cond_wait(&done_cond, &aio_lock);
+    }
+    pthread_mutex_unlock(&aio_lock);
+}
+
+void aio_read_async(void *buf, uint32_t length, uint64_t offset, void (*done)(void *arg), void *arg) {
+    struct aio_req_s *req = new_request(0, buf, length, offset);
+
+    if (!req) return;
+    req->done = done;
+    req->arg = arg;
+    submit_list(req);
+}
+
+/* Espera tudo o que está em voo, inclusive leituras sem lote */
+void aio_drain() {
+    pthread_mutex_lock(&aio_lock);
+    while (in_flight > 0) {
+        pthread_cond_wait(&done_cond, &aio_lock);
+    }
+    pthread_mutex_unlock(&aio_lock);
+}
+
+/* Troca de backend; só vale com nada em voo */
+int aio_use_pool(int pool) {
+    pthread_once(&aio_once, aio_init);
+    aio_drain();
+    if (!pool && ring.fd < 0) {
+        printf("Erro: io_uring não está disponível neste kernel.\n");
+        return -1;
+    }
+    use_pool = pool;
+    return 0;
+}
+
+const char *aio_backend() {
+    pthread_once(&aio_once, aio_init);
+    return use_pool ? "threads" : "io_uring";
+}
+
+void aio_print_stats() {
+    printf("E/S assíncrona: %s, profundidade %d\n", aio_backend(), AIO_QUEUE_DEPTH);
+    printf("Pedidos: %llu em %llu lotes, máximo em voo: %u\n",
+           (unsigned long long)aio_stats.requests, (unsigned long long)aio_stats.batches,
+           aio_stats.max_in_flight);
+}
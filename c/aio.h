@@ -0,0 +1,42 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include <stdint.h>
+
+#define AIO_QUEUE_DEPTH 64
+#define AIO_THREADS     4
+
+/*
+ * E/S assíncrona de blocos: io_uring quando o kernel permite, senão um
+ * grupo de threads fazendo pread/pwrite. Os pedidos de um lote são
+ * enfileirados e enviados juntos; aio_wait espera todos terminarem.
+ */
+struct aio_req_s;
+struct aio_batch_s {
+    _Atomic uint32_t pending;
+    struct aio_req_s *queued;
+};
+
+struct aio_stats_s {
+    uint64_t requests;
+    uint64_t batches;
+    uint32_t max_in_flight;
+};
+extern struct aio_stats_s aio_stats;
+
+void aio_read(struct aio_batch_s *batch, void *buf, uint32_t length, uint64_t offset);
+void aio_write(struct aio_batch_s *batch, const void *buf, uint32_t length, uint64_t offset);
+void aio_read_blocks(struct aio_batch_s *batch, const uint32_t *blocks, uint32_t count, uint8_t *buf);
+void aio_write_blocks(struct aio_batch_s *batch, const uint32_t *blocks, uint32_t count, const uint8_t *buf);
+void aio_submit(struct aio_batch_s *batch);
+void aio_wait(struct aio_batch_s *batch);
+
+/* Leitura sem espera; done roda na thread de conclusão e não pode bloquear */
+void aio_read_async(void *buf, uint32_t length, uint64_t offset, void (*done)(void *arg), void *arg);
+void aio_drain();
+
+int aio_use_pool(int pool);
+const char *aio_backend();
+void aio_print_stats();
+
+#endif
@@ -0,0 +1,378 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "alloc.h"
+#include "snapshot.h"
+#include "stats.h"
+
+#define GROUP_WORDS (ALLOC_GROUP_BLOCKS / 64)
+
+/*
+ * Grupo de alocação: uma faixa fixa de blocos com bitmap e trava próprios.
+ * Cada thread começa pelo seu grupo e só visita os outros quando ele seca.
+ */
+struct group_s {
+    pthread_mutex_t lock;
+    uint64_t map[GROUP_WORDS];      /* bit ligado = bloco livre */
+    _Atomic uint32_t free;          /* muda com a trava; sem ela, só dica */
+    uint32_t first_free_word;       /* nenhuma palavra antes desta tem bloco livre */
+};
+
+/* Sequência sendo montada; o elo entre grupos é gravado fora da trava */
+struct run_s {
+    int first;
+    int last;
+    int link_from;
+    int link_to;
+};
+
+/* Refeitos por free_map_build quando a geometria muda */
+static struct group_s *groups = NULL;
+static uint32_t group_count = 0;
+/* Blocos livres ainda não reservados por nenhuma alocação */
+static _Atomic uint32_t free_count = 0;
+static atomic_uint next_home = 0;
+static _Thread_local int home_group = -1;
+
+int alloc_contiguous = 1;
+
+/*
+ * Esvazia os grupos e os refaz se a geometria mudou. Chamar antes de
+ * qualquer set_fat na imagem nova: a releitura do diário já trava grupos.
+ */
+int alloc_reset() {
+    struct group_s *new_groups;
+
+    atomic_store(&free_count, 0);
+    if (group_count == ALLOC_GROUPS) {
+        for (uint32_t g = 0; g < group_count; g++) {
+            memset(groups[g].map, 0, sizeof(groups[g].map));
+            atomic_store(&groups[g].free, 0);
+            groups[g].first_free_word = 0;
+        }
+        return 0;
+    }
+
+    new_groups = calloc(ALLOC_GROUPS, sizeof(struct group_s));
+    if (!new_groups) {
+        printf("Erro: Memória insuficiente para %u grupos de alocação.\n", ALLOC_GROUPS);
+        return -1;
+    }
+    for (uint32_t g = 0; g < group_count; g++) {
+        pthread_mutex_destroy(&groups[g].lock);
+    }
+    free(groups);
+
+    groups = new_groups;
+    group_count = ALLOC_GROUPS;
+    for (uint32_t g = 0; g < group_count; g++) {
+        pthread_mutex_init(&groups[g].lock, NULL);
+    }
+    return 0;
+}
+
+static struct group_s *group_of(uint32_t block) {
+    return &groups[block / ALLOC_GROUP_BLOCKS];
+}
+
+void alloc_group_lock(uint32_t block) {
+    pthread_mutex_lock(&group_of(block)->lock);
+}
+
+void alloc_group_unlock(uint32_t block) {
+    pthread_mutex_unlock(&group_of(block)->lock);
+}
+
+/* Grupo preferido da thread, distribuído em rodízio no primeiro uso */
+static int home() {
+    if (home_group == -1) home_group = atomic_fetch_add(&next_home, 1) % ALLOC_GROUPS;
+    return home_group;
+}
+
+void free_map_build() {
+    uint32_t total = 0;
+
+    /* Sem grupos, free_count fica zerado e nenhuma alocação passa da reserva */
+    if (alloc_reset() == -1) return;
+
+    for (uint32_t i = ROOT_BLOCK + 1; i < BLOCKS; i++) {
+        if (fat[i] == FAT_FREE && !snapshot_shared(i)) {
+            struct group_s *g = group_of(i);
+            g->map[(i % ALLOC_GROUP_BLOCKS) / 64] |= (uint64_t)1 << (i % 64);
+            atomic_fetch_add(&g->free, 1);
+            total++;
+        }
+    }
+    atomic_store(&free_count, total);
+}
+
+static int is_free(uint32_t block) {
+    return block < BLOCKS && (group_of(block)->map[(block % ALLOC_GROUP_BLOCKS) / 64] >> (block % 64)) & 1;
+}
+
+/*
+ * Chamado por set_fat com a trava do grupo do bloco. Blocos ocupados já
+ * foram descontados de free_count na reserva; os liberados voltam a ele,
+ * exceto os retidos por snapshots, que só voltam com snapshot_delete.
+ */
+void free_map_update(uint32_t block, int is_free) {
+    struct group_s *g = group_of(block);
+    uint32_t word = (block % ALLOC_GROUP_BLOCKS) / 64;
+    uint64_t bit = (uint64_t)1 << (block % 64);
+
+    if (block <= ROOT_BLOCK || block >= BLOCKS) return;
+    /* Liberado na FAT viva, mas ainda usado por um snapshot: fica fora do mapa */
+    if (is_free && snapshot_shared(block)) return;
+
+    if (is_free && !(g->map[word] & bit)) {
+        g->map[word] |= bit;
+        atomic_fetch_add(&g->free, 1);
+        if (word < g->first_free_word) g->first_free_word = word;
+        atomic_fetch_add(&free_count, 1);
+    } else if (!is_free && (g->map[word] & bit)) {
+        g->map[word] &= ~bit;
+        atomic_fetch_sub(&g->free, 1);
+    }
+}
+
+uint32_t free_blocks() {
+    return atomic_load(&free_count);
+}
+
+/* Reserva num_blocks de free_count: garante que a busca nos grupos termina */
+static int reserve(uint32_t num_blocks) {
+    uint32_t available = atomic_load(&free_count);
+
+    do {
+        if (available < num_blocks) return -1;
+    } while (!atomic_compare_exchange_weak(&free_count, &available, available - num_blocks));
+    return 0;
+}
+
+/* Grava com a trava do grupo de block */
+void link_block(uint32_t block, uint32_t value) {
+    alloc_group_lock(block);
+    set_fat(block, value);
+    alloc_group_unlock(block);
+}
+
+/* Marca block (grupo g travado) como fim da sequência em montagem */
+static void take(struct group_s *g, uint32_t block, struct run_s *run) {
+    set_fat(block, FAT_EOF);
+    if (run->first == -1) {
+        run->first = block;
+    } else if (group_of(run->last) == g) {
+        set_fat(run->last, block);
+    } else {
+        run->link_from = run->last;
+        run->link_to = block;
+    }
+    run->last = block;
+}
+
+/* Depois de soltar o grupo: liga o lote ao bloco anterior de outro grupo */
+static void finish_batch(struct run_s *run) {
+    if (run->link_from != -1) {
+        link_block(run->link_from, run->link_to);
+        run->link_from = -1;
+    }
+}
+
+/* Menor bloco livre do grupo, achado uma palavra de 64 blocos por vez */
+static int group_lowest(struct group_s *g) {
+    uint32_t base = (g - groups) * ALLOC_GROUP_BLOCKS;
+
+    while (g->first_free_word < GROUP_WORDS) {
+        uint64_t word = g->map[g->first_free_word];
+        if (word) {
+            return base + g->first_free_word * 64 + __builtin_ctzll(word);
+        }
+        g->first_free_word++;
+    }
+    return -1;
+}
+
+/* Primeira sequência livre do grupo com pelo menos want blocos; sem ela, a maior */
+static int group_run(struct group_s *g, uint32_t want, uint32_t *run_length) {
+    uint32_t best_start = 0, best_length = 0;
+    uint32_t end = (g - groups + 1) * ALLOC_GROUP_BLOCKS;
+    uint32_t block = (g - groups) * ALLOC_GROUP_BLOCKS + g->first_free_word * 64;
+
+    while (block < end) {
+        uint64_t word = g->map[(block % ALLOC_GROUP_BLOCKS) / 64] >> (block % 64);
+
+        if (word == 0) {
+            block = (block / 64 + 1) * 64;
+            continue;
+        }
+        block += __builtin_ctzll(word);
+
+        uint32_t start = block;
+        while (block < end && is_free(block)) {
+            block++;
+        }
+
+        if (block - start > best_length) {
+            best_start = start;
+            best_length = block - start;
+            if (best_length >= want) break;
+        }
+    }
+
+    *run_length = best_length;
+    return best_length ? (int)best_start : -1;
+}
+
+/* Blocos livres em sequência a partir de block, atravessando grupos */
+static void extend_from(uint32_t block, uint32_t *remaining, struct run_s *run) {
+    while (*remaining > 0 && block < BLOCKS) {
+        struct group_s *g = group_of(block);
+        uint32_t end = (g - groups + 1) * ALLOC_GROUP_BLOCKS;
+
+        STAT_INC(STAT_ALLOC_GROUP);
+        pthread_mutex_lock(&g->lock);
+        while (*remaining > 0 && block < end && is_free(block)) {
+            take(g, block++, run);
+            (*remaining)--;
+        }
+        pthread_mutex_unlock(&g->lock);
+        finish_batch(run);
+
+        if (block < end) break;
+    }
+}
+
+/*
+ * Voltas pelos grupos antes de desistir. A reserva garante os blocos e a
+ * segunda volta acha os liberados no meio da primeira; se nem assim, os
+ * bitmaps divergiram de free_count.
+ */
+#define MAX_PASSES 2
+
+/* Menores blocos livres, começando pelo grupo da thread; devolve quantos faltaram */
+static uint32_t take_lowest(uint32_t remaining, struct run_s *run) {
+    for (uint32_t i = 0; remaining > 0 && i < MAX_PASSES * ALLOC_GROUPS; i++) {
+        struct group_s *g = &groups[(home() + i) % ALLOC_GROUPS];
+        int block;
+
+        if (atomic_load(&g->free) == 0) continue;
+        STAT_INC(STAT_ALLOC_GROUP);
+        pthread_mutex_lock(&g->lock);
+        while (remaining > 0 && (block = group_lowest(g)) != -1) {
+            take(g, block, run);
+            remaining--;
+        }
+        pthread_mutex_unlock(&g->lock);
+        finish_batch(run);
+    }
+    return remaining;
+}
+
+/* Uma sequência de remaining blocos em algum grupo; senão, as maiores de cada grupo */
+static uint32_t take_runs(uint32_t remaining, struct run_s *run) {
+    for (uint32_t i = 0; i < ALLOC_GROUPS && remaining > 0; i++) {
+        struct group_s *g = &groups[(home() + i) % ALLOC_GROUPS];
+        uint32_t length;
+        int start;
+
+        if (atomic_load(&g->free) < remaining) continue;
+        STAT_INC(STAT_ALLOC_GROUP);
+        pthread_mutex_lock(&g->lock);
+        start = group_run(g, remaining, &length);
+        if (start != -1 && length >= remaining) {
+            for (uint32_t block = start; block < start + remaining; block++) {
+                take(g, block, run);
+            }
+            remaining = 0;
+        }
+        pthread_mutex_unlock(&g->lock);
+        finish_batch(run);
+    }
+
+    for (uint32_t i = 0; remaining > 0 && i < MAX_PASSES * ALLOC_GROUPS; i++) {
+        struct group_s *g = &groups[(home() + i) % ALLOC_GROUPS];
+        uint32_t length;
+        int start;
+
+        if (atomic_load(&g->free) == 0) continue;
+        STAT_INC(STAT_ALLOC_GROUP);
+        pthread_mutex_lock(&g->lock);
+        while (remaining > 0 && (start = group_run(g, remaining, &length)) != -1) {
+            if (length > remaining) length = remaining;
+            for (uint32_t block = start; block < start + length; block++) {
+                take(g, block, run);
+            }
+            remaining -= length;
+        }
+        pthread_mutex_unlock(&g->lock);
+        finish_batch(run);
+    }
+    return remaining;
+}
+
+/* Os grupos secaram antes da reserva: devolve os blocos tomados e o resto dela */
+static int give_back(struct run_s *run, uint32_t remaining) {
+    if (run->first != -1) free_chain(run->first);
+    atomic_fetch_add(&free_count, remaining);
+    printf("Erro: Mapa de blocos livres inconsistente; alocação desfeita.\n");
+    return -1;
+}
+
+int allocate_blocks(int num_blocks) {
+    struct run_s run = { -1, -1, -1, -1 };
+
+    STAT_INC(STAT_ALLOC);
+    if (num_blocks <= 0 || reserve(num_blocks) == -1) {
+        printf("Erro: Não há blocos suficientes disponíveis.\n");
+        return -1;
+    }
+
+    uint32_t missing = take_lowest(num_blocks, &run);
+    if (missing > 0) return give_back(&run, missing);
+    return run.first;
+}
+
+/*
+ * Aloca num_blocks em sequências contíguas: de preferência logo após tail
+ * (o último bloco do arquivo), senão a primeira sequência que caiba e, em
+ * último caso, as maiores sequências disponíveis. Com tail >= 0 os blocos
+ * novos já saem encadeados após ele.
+ */
+int allocate_extent(int num_blocks, int tail) {
+    struct run_s run = { -1, -1, -1, -1 };
+    uint32_t remaining = num_blocks;
+
+    STAT_INC(STAT_ALLOC);
+    if (num_blocks <= 0 || reserve(num_blocks) == -1) {
+        printf("Erro: Não há blocos suficientes disponíveis.\n");
+        return -1;
+    }
+
+    if (!alloc_contiguous) {
+        remaining = take_lowest(remaining, &run);
+    } else {
+        if (tail >= 0) extend_from(tail + 1, &remaining, &run);
+        remaining = take_runs(remaining, &run);
+    }
+    if (remaining > 0) return give_back(&run, remaining);
+
+    if (tail >= 0) link_block(tail, run.first);
+    return run.first;
+}
+
+/* Número de sequências contíguas na cadeia: 1 = arquivo sem fragmentação */
+int count_extents(uint32_t first_block) {
+    int extents = 0;
+    uint32_t previous = 0;
+
+    for (uint32_t block = first_block; block < BLOCKS && block != FAT_EOF; block = fat[block]) {
+        if (extents == 0 || block != previous + 1) extents++;
+        previous = block;
+        if (fat[block] == FAT_FREE) break;
+    }
+    return extents;
+}
@@ -0,0 +1,29 @@
+#ifndef ALLOC_H
+#define ALLOC_H
+
+#include <stdint.h>
+
+#define ALLOC_GROUP_BLOCKS 128
+#define ALLOC_GROUPS       ((BLOCKS + ALLOC_GROUP_BLOCKS - 1) / ALLOC_GROUP_BLOCKS)
+
+/*
+ * Grupos de alocação: cada um guarda o bitmap de uma faixa de blocos sob
+ * trava própria. set_fat deve ser chamado com a trava do grupo do bloco.
+ */
+int alloc_reset();
+void alloc_group_lock(uint32_t block);
+void alloc_group_unlock(uint32_t block);
+void link_block(uint32_t block, uint32_t value);
+
+/* Índice de blocos livres (bitmap) mantido em sincronia com a FAT */
+void free_map_build();
+void free_map_update(uint32_t block, int is_free);
+uint32_t free_blocks();
+int allocate_blocks(int num_blocks);
+
+/* Alocação em sequências contíguas para write/append */
+extern int alloc_contiguous;
+int allocate_extent(int num_blocks, int hint);
+int count_extents(uint32_t first_block);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ * Bancada de desempenho: dirige as operações reais de filesystem.c contra
+ * uma imagem descartável. Só existe com o main do shell compilado fora:
+ *
+ *     gcc -O2 -pthread -DFILESYSTEM_NO_MAIN -o bench *.c
+ *     ./bench [imagem] [escala]
+ *
+ * A saída das operações (ls, read, erros) vai para /dev/null; o relatório
+ * sai em stderr. Para cada carga: ops/s, MB/s e latências p50/p99 por
+ * operação, e as chamadas ao sistema e blocos lidos/gravados da carga.
+ */
+#ifdef FILESYSTEM_NO_MAIN
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "device.h"
+#include "cache.h"
+#include "alloc.h"
+#include "aio.h"
+#include "stats.h"
+
+#define BENCH_IMAGE      "bench.dat"
+#define BENCH_BLOCK_SIZE 4096
+#define BENCH_BLOCKS     65536      /* por unidade de escala: 256 MB */
+#define BENCH_CHUNK      (1u << 20)
+
+/* Operações do shell: sem protótipo no cabeçalho, que conflitaria com unistd.h */
+void ls(const char *path);
+void mkdir(const char *path);
+void create(const char *path);
+void unlink(const char *path);
+void write(const char *data, int rep, const char *path);
+void append(const char *data, int rep, const char *path);
+void read(const char *path, uint32_t offset, uint32_t length);
+
+struct series_s {
+    const char *name;
+    uint64_t *ns;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t bytes;
+    uint64_t elapsed;
+};
+
+struct io_mark_s {
+    uint64_t syscalls;
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t aio;
+};
+
+static FILE *report;
+static uint32_t scale = 1;
+static uint64_t rng = 0x9e3779b97f4a7c15ull;
+
+static uint32_t random_below(uint32_t n) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (uint32_t)(rng % n);
+}
+
+static void record(struct series_s *series, uint64_t start, uint64_t bytes) {
+    uint64_t elapsed = stat_now() - start;
+
+    if (series->count == series->capacity) {
+        uint32_t capacity = series->capacity ? 2 * series->capacity : 1024;
+        uint64_t *ns = realloc(series->ns, capacity * sizeof(uint64_t));
+        if (!ns) return;
+        series->ns = ns;
+        series->capacity = capacity;
+    }
+    series->ns[series->count++] = elapsed;
+    series->bytes += bytes;
+    series->elapsed += elapsed;
+}
+
+static int compare_ns(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void print_series(struct series_s *series) {
+    if (series->count == 0) return;
+
+    qsort(series->ns, series->count, sizeof(uint64_t), compare_ns);
+    double seconds = series->elapsed / 1e9;
+    fprintf(report, "  %-10s %8u %12.0f %10.1f %10.1f %10.1f\n", series->name, series->count,
+            seconds > 0 ? series->count / seconds : 0.0, seconds > 0 ? series->bytes / 1e6 / seconds : 0.0,
+            series->ns[series->count / 2] / 1e3, series->ns[(uint64_t)series->count * 99 / 100] / 1e3);
+    free(series->ns);
+    memset(series, 0, sizeof(*series));
+}
+
+static void io_mark(struct io_mark_s *mark) {
+    mark->syscalls = dev_stats.reads + dev_stats.writes + dev_stats.syncs + dev_stats.ring_enters;
+    mark->blocks_read = dev_stats.bytes_read / BLOCK_SIZE;
+    mark->blocks_written = dev_stats.bytes_written / BLOCK_SIZE;
+    mark->aio = aio_stats.requests;
+}
+
+static void begin_load(const char *name, struct io_mark_s *mark) {
+    fprintf(report, "%s\n", name);
+    /* Dois bytes a mais pelos acentos */
+    fprintf(report, "  %-12s %8s %12s %10s %10s %10s\n", "operação", "ops", "ops/s", "MB/s", "p50 (us)", "p99 (us)");
+    io_mark(mark);
+}
+
+static void end_load(const struct io_mark_s *before) {
+    struct io_mark_s after;
+
+    io_mark(&after);
+    fprintf(report, "  E/S: %llu chamadas ao sistema, %llu blocos lidos, %llu blocos gravados, "
+            "%llu pedidos assíncronos\n\n",
+            (unsigned long long)(after.syscalls - before->syscalls),
+            (unsigned long long)(after.blocks_read - before->blocks_read),
+            (unsigned long long)(after.blocks_written - before->blocks_written),
+            (unsigned long long)(after.aio - before->aio));
+}
+
+static void timed_flush(struct series_s *series) {
+    uint64_t t = stat_now();
+
+    flush_filesystem();
+    record(series, t, 0);
+}
+
+/* Árvore de 4 níveis com 4 subdiretórios cada; arquivos criados, listados e removidos nas folhas */
+static void metadata_storm() {
+    struct series_s mkdirs = { .name = "mkdir" }, creates = { .name = "create" }, lists = { .name = "ls" };
+    struct series_s unlinks = { .name = "unlink" }, flushes = { .name = "sync" };
+    struct io_mark_s mark;
+    char leaves[256][64], path[128];
+    uint32_t leaf_count = 0, files = 4000 * scale;
+    uint64_t t;
+
+    begin_load("Metadados: árvore 4x4x4x4, criação e remoção", &mark);
+    t = stat_now();
+    mkdir("/m");
+    record(&mkdirs, t, 0);
+    for (uint32_t i = 0; i < 4 * 4 * 4 * 4; i++) {
+        uint32_t a = i / 64, b = i / 16 % 4, c = i / 4 % 4, d = i % 4;
+
+        snprintf(leaves[leaf_count], sizeof(leaves[0]), "/m/a%u/b%u/c%u/d%u", a, b, c, d);
+        /* Os níveis intermediários nascem com o primeiro filho */
+        if (b == 0 && c == 0 && d == 0) {
+            snprintf(path, sizeof(path), "/m/a%u", a);
+            t = stat_now();
+            mkdir(path);
+            record(&mkdirs, t, 0);
+        }
+        if (c == 0 && d == 0) {
+            snprintf(path, sizeof(path), "/m/a%u/b%u", a, b);
+            t = stat_now();
+            mkdir(path);
+            record(&mkdirs, t, 0);
+        }
+        if (d == 0) {
+            snprintf(path, sizeof(path), "/m/a%u/b%u/c%u", a, b, c);
+            t = stat_now();
+            mkdir(path);
+            record(&mkdirs, t, 0);
+        }
+        t = stat_now();
+        mkdir(leaves[leaf_count]);
+        record(&mkdirs, t, 0);
+        leaf_count++;
+    }
+
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", leaves[i % leaf_count], i);
+        t = stat_now();
+        create(path);
+        record(&creates, t, 0);
+    }
+    snprintf(path, sizeof(path), "%s/f%u", leaves[(files - 1) % leaf_count], files - 1);
+    if (find_file_block(path) == -1) fprintf(report, "  falhou: '%s' não foi criado\n", path);
+
+    for (uint32_t i = 0; i < leaf_count; i++) {
+        t = stat_now();
+        ls(leaves[i]);
+        record(&lists, t, 0);
+    }
+    for (uint32_t i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "%s/f%u", leaves[i % leaf_count], i);
+        t = stat_now();
+        unlink(path);
+        record(&unlinks, t, 0);
+    }
+    timed_flush(&flushes);
+
+    print_series(&mkdirs);
+    print_series(&creates);
+    print_series(&lists);
+    print_series(&unlinks);
+    print_series(&flushes);
+    end_load(&mark);
+}
+
+/* Um arquivo grande escrito e lido em pedaços de 1 MB */
+static void sequential(const char *chunk) {
+    struct series_s writes = { .name = "write" }, reads = { .name = "read" }, flushes = { .name = "sync" };
+    struct io_mark_s mark;
+    uint32_t chunks = 32 * scale;
+    uint64_t t;
+
+    begin_load("Sequencial: arquivo grande em pedaços de 1 MB", &mark);
+    create("/seq");
+    for (uint32_t i = 0; i < chunks; i++) {
+        t = stat_now();
+        if (i == 0) write(chunk, BENCH_CHUNK / 1024, "/seq");
+        else append(chunk, BENCH_CHUNK / 1024, "/seq");
+        record(&writes, t, BENCH_CHUNK);
+    }
+    timed_flush(&flushes);
+    for (uint32_t i = 0; i < chunks; i++) {
+        t = stat_now();
+        read("/seq", i * BENCH_CHUNK, BENCH_CHUNK);
+        record(&reads, t, BENCH_CHUNK);
+    }
+    unlink("/seq");
+    timed_flush(&flushes);
+
+    print_series(&writes);
+    print_series(&reads);
+    print_series(&flushes);
+    end_load(&mark);
+}
+
+/* Anexos de 100 bytes distribuídos entre 64 arquivos, como um log */
+static void small_appends() {
+    struct series_s appends = { .name = "append" }, flushes = { .name = "sync" };
+    struct io_mark_s mark;
+    char path[64];
+    uint64_t t;
+
+    begin_load("Anexos pequenos: 100 bytes em 64 arquivos", &mark);
+    mkdir("/log");
+    for (uint32_t i = 0; i < 64; i++) {
+        snprintf(path, sizeof(path), "/log/l%u", i);
+        create(path);
+    }
+    for (uint32_t i = 0; i < 20000 * scale; i++) {
+        snprintf(path, sizeof(path), "/log/l%u", i % 64);
+        t = stat_now();
+        append("0123456789", 10, path);
+        record(&appends, t, 100);
+    }
+    timed_flush(&flushes);
+
+    print_series(&appends);
+    print_series(&flushes);
+    end_load(&mark);
+}
+
+/*
+ * Envelhecimento: rodadas de escrita de arquivos de tamanhos variados e
+ * remoção de metade ao acaso; no fim, um arquivo grande é escrito no
+ * espaço fragmentado e lido de volta.
+ */
+static void aging(const char *chunk) {
+    struct series_s writes = { .name = "write" }, unlinks = { .name = "unlink" };
+    struct series_s big = { .name = "write big" }, reads = { .name = "read big" };
+    struct io_mark_s mark;
+    uint32_t slots = 2000 * scale, rounds = 8;
+    uint8_t *alive = calloc(slots, 1);
+    char path[64];
+    uint64_t t;
+
+    if (!alive) return;
+    begin_load("Envelhecimento: escrita e remoção ao acaso, depois arquivo grande", &mark);
+    mkdir("/age");
+    for (uint32_t round = 0; round < rounds; round++) {
+        for (uint32_t i = 0; i < slots; i++) {
+            if (alive[i]) continue;
+            uint32_t kb = 1 + random_below(32);
+
+            snprintf(path, sizeof(path), "/age/a%u", i);
+            create(path);
+            t = stat_now();
+            write(chunk, kb, path);
+            record(&writes, t, kb * 1024);
+            alive[i] = 1;
+        }
+        for (uint32_t i = 0; i < slots; i++) {
+            if (!alive[i] || random_below(2)) continue;
+
+            snprintf(path, sizeof(path), "/age/a%u", i);
+            t = stat_now();
+            unlink(path);
+            record(&unlinks, t, 0);
+            alive[i] = 0;
+        }
+    }
+
+    create("/age/big");
+    for (uint32_t i = 0; i < 8 * scale; i++) {
+        t = stat_now();
+        if (i == 0) write(chunk, BENCH_CHUNK / 1024, "/age/big");
+        else append(chunk, BENCH_CHUNK / 1024, "/age/big");
+        record(&big, t, BENCH_CHUNK);
+    }
+    int first = find_file_block("/age/big");
+    flush_filesystem();
+    for (uint32_t i = 0; i < 8 * scale; i++) {
+        t = stat_now();
+        read("/age/big", i * BENCH_CHUNK, BENCH_CHUNK);
+        record(&reads, t, BENCH_CHUNK);
+    }
+
+    print_series(&writes);
+    print_series(&unlinks);
+    print_series(&big);
+    print_series(&reads);
+    if (first != -1) fprintf(report, "  fragmentos do arquivo grande: %d\n", count_extents(first));
+    end_load(&mark);
+    free(alive);
+}
+
+/* allocate_blocks e free_chain isolados, em cadeias de 8 blocos */
+static void allocator() {
+    struct series_s allocs = { .name = "allocate" }, frees = { .name = "free" };
+    struct io_mark_s mark;
+    uint32_t count = 4000 * scale;
+    int *chains = malloc(count * sizeof(int));
+    uint64_t t;
+
+    if (!chains) return;
+    begin_load("Alocador: cadeias de 8 blocos", &mark);
+    for (uint32_t i = 0; i < count; i++) {
+        t = stat_now();
+        chains[i] = allocate_blocks(8);
+        record(&allocs, t, 0);
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        t = stat_now();
+        if (chains[i] != -1) free_chain(chains[i]);
+        record(&frees, t, 0);
+    }
+    commit_fat();
+
+    print_series(&allocs);
+    print_series(&frees);
+    end_load(&mark);
+    free(chains);
+}
+
+int main(int argc, char **argv) {
+    const char *image = argc >= 2 ? argv[1] : BENCH_IMAGE;
+    char *chunk = malloc(1025);
+
+    if (argc >= 3) scale = (uint32_t)strtoul(argv[2], NULL, 10);
+    if (scale == 0) scale = 1;
+    if (!chunk) return 1;
+    memset(chunk, 'x', 1024);
+    chunk[1024] = '\0';
+
+    report = stderr;
+    if (!freopen("/dev/null", "w", stdout)) return 1;
+
+    quiet = 1;
+    init_filesystem(image, 0, BENCH_BLOCK_SIZE, BENCH_BLOCKS * scale);
+    if (!dev_is_open()) {
+        fprintf(report, "Erro: não foi possível criar a imagem '%s'.\n", image);
+        return 1;
+    }
+    fprintf(report, "Imagem '%s': %u blocos de %u bytes, escala %u\n\n", image, BLOCKS, BLOCK_SIZE, scale);
+
+    metadata_storm();
+    sequential(chunk);
+    small_appends();
+    aging(chunk);
+    allocator();
+
+    flush_filesystem();
+    aio_drain();
+    dev_close();
+    remove(image);
+    free(chunk);
+    return 0;
+}
+#endif
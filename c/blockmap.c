@@ -0,0 +1,116 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "blockmap.h"
+
+struct block_map_s {
+    int valid;
+    uint32_t first_block;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t *blocks;
+};
+
+static struct block_map_s maps[BLOCK_MAP_SLOTS];
+/* Os mapas são compartilhados: quem consulta recebe uma cópia dos blocos */
+static pthread_mutex_t map_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Percorre a cadeia a partir do último bloco conhecido do mapa. O vetor
+ * cresce com a cadeia; sem memória o mapa é invalidado e devolve -1.
+ */
+static int map_walk(struct block_map_s *map) {
+    uint32_t block = map->count ? fat[map->blocks[map->count - 1]] : map->first_block;
+
+    while (block < BLOCKS && map->count < BLOCKS) {
+        if (map->count == map->capacity) {
+            uint32_t capacity = map->capacity ? map->capacity * 2 : 64;
+            uint32_t *blocks = realloc(map->blocks, (size_t)capacity * sizeof(uint32_t));
+
+            if (!blocks) {
+                map->valid = 0;
+                return -1;
+            }
+            map->blocks = blocks;
+            map->capacity = capacity;
+        }
+        map->blocks[map->count++] = block;
+        block = fat[block];
+    }
+    return 0;
+}
+
+static struct block_map_s *map_get(uint32_t first_block) {
+    struct block_map_s *map = &maps[first_block % BLOCK_MAP_SLOTS];
+
+    if (map->valid && map->first_block == first_block) return map;
+
+    map->valid = 1;
+    map->first_block = first_block;
+    map->count = 0;
+    if (map_walk(map) == -1) return NULL;
+    return map;
+}
+
+/* Número de blocos da cadeia (0 se não foi possível montar o mapa) */
+uint32_t block_map_length(uint32_t first_block) {
+    struct block_map_s *map;
+    uint32_t count = 0;
+
+    pthread_mutex_lock(&map_mutex);
+    map = map_get(first_block);
+    if (map) count = map->count;
+    pthread_mutex_unlock(&map_mutex);
+    return count;
+}
+
+/* Copia até max blocos a partir do bloco lógico index; devolve quantos */
+uint32_t block_map_blocks(uint32_t first_block, uint32_t index, uint32_t *blocks, uint32_t max) {
+    struct block_map_s *map;
+    uint32_t count = 0;
+
+    pthread_mutex_lock(&map_mutex);
+    map = map_get(first_block);
+    if (map && index < map->count) {
+        count = map->count - index < max ? map->count - index : max;
+        memcpy(blocks, &map->blocks[index], count * sizeof(uint32_t));
+    }
+    pthread_mutex_unlock(&map_mutex);
+    return count;
+}
+
+/* A cadeia cresceu no fim: só os blocos novos são percorridos */
+void block_map_extend(uint32_t first_block) {
+    struct block_map_s *map = &maps[first_block % BLOCK_MAP_SLOTS];
+
+    pthread_mutex_lock(&map_mutex);
+    if (map->valid && map->first_block == first_block) map_walk(map);
+    pthread_mutex_unlock(&map_mutex);
+}
+
+void block_map_truncate(uint32_t first_block, uint32_t count) {
+    struct block_map_s *map = &maps[first_block % BLOCK_MAP_SLOTS];
+
+    pthread_mutex_lock(&map_mutex);
+    if (map->valid && map->first_block == first_block && count < map->count) map->count = count;
+    pthread_mutex_unlock(&map_mutex);
+}
+
+void block_map_drop(uint32_t first_block) {
+    struct block_map_s *map = &maps[first_block % BLOCK_MAP_SLOTS];
+
+    pthread_mutex_lock(&map_mutex);
+    if (map->first_block == first_block) map->valid = 0;
+    pthread_mutex_unlock(&map_mutex);
+}
+
+void block_map_reset() {
+    pthread_mutex_lock(&map_mutex);
+    for (int i = 0; i < BLOCK_MAP_SLOTS; i++) {
+        maps[i].valid = 0;
+    }
+    pthread_mutex_unlock(&map_mutex);
+}
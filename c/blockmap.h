@@ -0,0 +1,16 @@
+#ifndef BLOCKMAP_H
+#define BLOCKMAP_H
+
+#include <stdint.h>
+
+#define BLOCK_MAP_SLOTS 16
+
+/* Mapa bloco lógico -> bloco físico de um arquivo, evitando percorrer a FAT */
+uint32_t block_map_length(uint32_t first_block);
+uint32_t block_map_blocks(uint32_t first_block, uint32_t index, uint32_t *blocks, uint32_t max);
+void block_map_extend(uint32_t first_block);
+void block_map_truncate(uint32_t first_block, uint32_t count);
+void block_map_drop(uint32_t first_block);
+void block_map_reset();
+
+#endif
@@ -0,0 +1,482 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "device.h"
+#include "cache.h"
+#include "aio.h"
+#include "journal.h"
+
+#define NONE  -1
+#define RETRY -2      /* cache_slot soltou a trava: refazer a busca */
+
+struct cache_entry {
+    uint32_t block;
+    int dirty;
+    int prefetched;   /* veio de leitura antecipada e ainda não foi lido */
+    int loading;      /* lido do disco sem a trava: dados ainda inválidos */
+    int writing;      /* gravado de volta sem a trava: dados só para leitura */
+    int prev;
+    int next;
+    uint8_t *data;
+};
+
+struct cache_stats_s cache_stats;
+
+static struct cache_entry *entries = NULL;
+static uint8_t *cache_data = NULL;
+static uint32_t capacity = 0;
+static uint32_t used = 0;
+static int lru_head = NONE;   /* mais recentemente usado */
+static int lru_tail = NONE;   /* candidato à remoção */
+static int *slot_of = NULL;
+/* Conta as gravações de cada bloco: leituras antecipadas velhas são descartadas */
+static uint32_t *write_gen = NULL;
+/* Geometria para a qual as tabelas e os dados foram alocados */
+static uint32_t table_blocks = 0;
+static uint32_t data_block_size = 0;
+/*
+ * Protege a LRU, os slots e as estatísticas. A E/S do disco é feita sem
+ * ela: o slot fica marcado (loading ou writing), não sai da cache e quem
+ * precisa dele espera em slot_ready.
+ */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slot_ready = PTHREAD_COND_INITIALIZER;
+/* Slots com E/S em curso; a realocação das tabelas espera chegar a zero */
+static uint32_t busy = 0;
+
+static void lru_unlink(int slot) {
+    struct cache_entry *e = &entries[slot];
+
+    if (e->prev != NONE) entries[e->prev].next = e->next;
+    else lru_head = e->next;
+    if (e->next != NONE) entries[e->next].prev = e->prev;
+    else lru_tail = e->prev;
+    e->prev = e->next = NONE;
+}
+
+static void lru_push_front(int slot) {
+    entries[slot].prev = NONE;
+    entries[slot].next = lru_head;
+    if (lru_head != NONE) entries[lru_head].prev = slot;
+    lru_head = slot;
+    if (lru_tail == NONE) lru_tail = slot;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    uint32_t x = entries[*(const int *)a].block;
+    uint32_t y = entries[*(const int *)b].block;
+    return (x > y) - (x < y);
+}
+
+static int in_io(int slot) {
+    return entries[slot].loading || entries[slot].writing;
+}
+
+/* Chamar com cache_mutex: espera terminar a E/S de todos os slots */
+static void wait_idle() {
+    while (busy > 0) {
+        pthread_cond_wait(&slot_ready, &cache_mutex);
+    }
+}
+
+/*
+ * Envia os blocos sujos em ordem crescente de bloco, todos num só lote.
+ * Chamar com cache_mutex, que fica solta durante o diário e a gravação.
+ */
+static void flush_dirty() {
+    int *dirty = malloc((used ? used : 1) * sizeof(int));
+    struct aio_batch_s batch = {0};
+    uint32_t n = 0;
+
+    if (!dirty) return;
+    for (uint32_t i = 0; i < used; i++) {
+        if (entries[i].dirty) dirty[n++] = i;
+    }
+    if (n == 0) {
+        free(dirty);
+        return;
+    }
+    qsort(dirty, n, sizeof(int), compare_blocks);
+
+    for (uint32_t i = 0; i < n; i++) {
+        entries[dirty[i]].dirty = 0;
+        entries[dirty[i]].writing = 1;
+        busy++;
+        cache_stats.writebacks++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    /* Diretórios só vão para o lugar depois dos registros que os descrevem */
+    journal_force();
+    for (uint32_t i = 0; i < n; i++) {
+        struct cache_entry *e = &entries[dirty[i]];
+        aio_write(&batch, e->data, BLOCK_SIZE, (uint64_t)e->block * BLOCK_SIZE);
+    }
+    aio_wait(&batch);
+
+    pthread_mutex_lock(&cache_mutex);
+    for (uint32_t i = 0; i < n; i++) {
+        entries[dirty[i]].writing = 0;
+        busy--;
+    }
+    pthread_cond_broadcast(&slot_ready);
+    free(dirty);
+}
+
+/* Chamar com cache_mutex: no fim nenhum slot está sujo nem em E/S */
+static void flush_all() {
+    int dirty;
+
+    do {
+        flush_dirty();
+        wait_idle();
+        dirty = 0;
+        for (uint32_t i = 0; i < used && !dirty; i++) {
+            dirty = entries[i].dirty;
+        }
+    } while (dirty);
+}
+
+void cache_flush() {
+    pthread_mutex_lock(&cache_mutex);
+    flush_all();
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+static void invalidate_all() {
+    for (uint32_t i = 0; i < table_blocks; i++) {
+        slot_of[i] = NONE;
+    }
+    used = 0;
+    lru_head = lru_tail = NONE;
+}
+
+/* Ajusta as tabelas e os dados à geometria atual; a cache deve estar limpa */
+static int fit_geometry() {
+    if (table_blocks != BLOCKS) {
+        int *new_slots = malloc((size_t)BLOCKS * sizeof(int));
+        uint32_t *new_gen = calloc(BLOCKS, sizeof(uint32_t));
+
+        if (!new_slots || !new_gen) {
+            free(new_slots);
+            free(new_gen);
+            return -1;
+        }
+        free(slot_of);
+        free(write_gen);
+        slot_of = new_slots;
+        write_gen = new_gen;
+        table_blocks = BLOCKS;
+    }
+
+    if (capacity && data_block_size != BLOCK_SIZE) {
+        uint8_t *new_data = malloc((size_t)capacity * BLOCK_SIZE);
+
+        if (!new_data) return -1;
+        free(cache_data);
+        cache_data = new_data;
+        for (uint32_t i = 0; i < capacity; i++) {
+            entries[i].data = &cache_data[(size_t)i * BLOCK_SIZE];
+        }
+    }
+    data_block_size = BLOCK_SIZE;
+    return 0;
+}
+
+/* Esvazia a cache; chamada também a cada troca de geometria */
+int cache_invalidate() {
+    int status;
+
+    pthread_mutex_lock(&cache_mutex);
+    wait_idle();
+    status = fit_geometry();
+    if (status == -1) {
+        printf("Erro: Não foi possível alocar a cache para %u blocos.\n", BLOCKS);
+        free(slot_of);
+        free(write_gen);
+        slot_of = NULL;
+        write_gen = NULL;
+        table_blocks = 0;
+    }
+    invalidate_all();
+    pthread_mutex_unlock(&cache_mutex);
+    return status;
+}
+
+static int resize_locked(uint32_t new_capacity) {
+    struct cache_entry *new_entries;
+    uint8_t *new_data;
+
+    if (new_capacity == 0) new_capacity = 1;
+
+    new_entries = malloc(new_capacity * sizeof(struct cache_entry));
+    new_data = malloc((size_t)new_capacity * BLOCK_SIZE);
+    if (!new_entries || !new_data) {
+        free(new_entries);
+        free(new_data);
+        printf("Erro: Não foi possível alocar a cache de %u blocos.\n", new_capacity);
+        return -1;
+    }
+
+    flush_all();
+    free(entries);
+    free(cache_data);
+    entries = new_entries;
+    cache_data = new_data;
+    capacity = new_capacity;
+    data_block_size = BLOCK_SIZE;
+    for (uint32_t i = 0; i < capacity; i++) {
+        entries[i].data = &cache_data[(size_t)i * BLOCK_SIZE];
+    }
+    invalidate_all();
+    return 0;
+}
+
+int cache_resize(uint32_t new_capacity) {
+    int status;
+
+    pthread_mutex_lock(&cache_mutex);
+    status = resize_locked(new_capacity);
+    pthread_mutex_unlock(&cache_mutex);
+    return status;
+}
+
+uint32_t cache_capacity() {
+    return capacity;
+}
+
+/*
+ * Obtém um slot para o bloco, removendo o menos usado que não esteja em
+ * E/S. Se precisar soltar a trava (para gravar sujos ou esperar um slot)
+ * devolve RETRY; sem memória para a cache, NONE.
+ */
+static int cache_slot(uint32_t block) {
+    int slot;
+
+    if (capacity == 0 && resize_locked(CACHE_DEFAULT_BLOCKS) == -1) return NONE;
+
+    if (used < capacity) {
+        slot = used++;
+    } else {
+        for (slot = lru_tail; slot != NONE && in_io(slot); slot = entries[slot].prev);
+        if (slot == NONE) {
+            pthread_cond_wait(&slot_ready, &cache_mutex);
+            return RETRY;
+        }
+        if (entries[slot].dirty) {
+            /* Aproveita a remoção para descarregar todos os sujos em ordem */
+            flush_dirty();
+            return RETRY;
+        }
+        lru_unlink(slot);
+        slot_of[entries[slot].block] = NONE;
+        cache_stats.evictions++;
+        if (entries[slot].prefetched) cache_stats.prefetch_wasted++;
+    }
+
+    entries[slot].block = block;
+    entries[slot].dirty = 0;
+    entries[slot].prefetched = 0;
+    entries[slot].loading = 0;
+    entries[slot].writing = 0;
+    slot_of[block] = slot;
+    lru_push_front(slot);
+    return slot;
+}
+
+/* Primeiro uso de uma cópia lida antecipadamente: conta como leitura útil */
+static int consume_prefetch(int slot) {
+    if (!entries[slot].prefetched) return 0;
+    entries[slot].prefetched = 0;
+    cache_stats.prefetch_hits++;
+    return 1;
+}
+
+/* Devolve 1 se a cópia veio de uma leitura antecipada */
+int cache_read(uint32_t block, uint8_t *record) {
+    int slot, prefetched = 0;
+
+    if (block >= table_blocks) {
+        memset(record, 0, BLOCK_SIZE);
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    while (1) {
+        if (capacity && (slot = slot_of[block]) != NONE) {
+            /* Outra thread está lendo o bloco: espera a cópia dela */
+            if (entries[slot].loading) {
+                pthread_cond_wait(&slot_ready, &cache_mutex);
+                continue;
+            }
+            cache_stats.hits++;
+            prefetched = consume_prefetch(slot);
+            lru_unlink(slot);
+            lru_push_front(slot);
+            break;
+        }
+
+        if ((slot = cache_slot(block)) == RETRY) continue;
+        cache_stats.misses++;
+        if (slot == NONE) {
+            pthread_mutex_unlock(&cache_mutex);
+            dev_pread(record, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+            return 0;
+        }
+
+        entries[slot].loading = 1;
+        busy++;
+        pthread_mutex_unlock(&cache_mutex);
+        dev_pread(entries[slot].data, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+        pthread_mutex_lock(&cache_mutex);
+        entries[slot].loading = 0;
+        busy--;
+        pthread_cond_broadcast(&slot_ready);
+        break;
+    }
+
+    memcpy(record, entries[slot].data, BLOCK_SIZE);
+    pthread_mutex_unlock(&cache_mutex);
+    return prefetched;
+}
+
+void cache_write(uint32_t block, const uint8_t *record) {
+    int slot;
+
+    if (block >= table_blocks) {
+        dev_pwrite(record, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+        return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    while (1) {
+        if (capacity && (slot = slot_of[block]) != NONE) {
+            /* Dados em leitura ou em gravação de volta não mudam por baixo */
+            if (in_io(slot)) {
+                pthread_cond_wait(&slot_ready, &cache_mutex);
+                continue;
+            }
+            lru_unlink(slot);
+            lru_push_front(slot);
+            break;
+        }
+        if ((slot = cache_slot(block)) != RETRY) break;
+    }
+    if (slot == NONE) {
+        pthread_mutex_unlock(&cache_mutex);
+        dev_pwrite(record, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+        return;
+    }
+
+    memcpy(entries[slot].data, record, BLOCK_SIZE);
+    entries[slot].dirty = 1;
+    entries[slot].prefetched = 0;
+    write_gen[block]++;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/* Copia o bloco se estiver na cache, sem alterar a ordem LRU */
+int cache_peek(uint32_t block, uint8_t *record) {
+    int found = 0;
+
+    if (block >= table_blocks) return 0;
+
+    pthread_mutex_lock(&cache_mutex);
+    /* Um slot ainda em leitura só teria a cópia do disco */
+    if (capacity && slot_of[block] != NONE && !entries[slot_of[block]].loading) {
+        memcpy(record, entries[slot_of[block]].data, BLOCK_SIZE);
+        consume_prefetch(slot_of[block]);
+        found = 1;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+/* O bloco acabou de ser gravado direto no disco: atualiza a cópia limpa */
+void cache_refresh(uint32_t block, const uint8_t *record) {
+    if (block >= table_blocks) return;
+
+    pthread_mutex_lock(&cache_mutex);
+    while (capacity && slot_of[block] != NONE && in_io(slot_of[block])) {
+        pthread_cond_wait(&slot_ready, &cache_mutex);
+    }
+    if (capacity && slot_of[block] != NONE) {
+        memcpy(entries[slot_of[block]].data, record, BLOCK_SIZE);
+        entries[slot_of[block]].dirty = 0;
+        entries[slot_of[block]].prefetched = 0;
+    }
+    write_gen[block]++;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+struct prefetch_s {
+    uint32_t block;
+    uint32_t gen;
+    uint8_t data[];
+};
+
+/*
+ * Conclusão de uma leitura antecipada. Roda na thread de E/S, que não pode
+ * esperar pela cache: sem a trava na hora, ou sem slot limpo e livre de
+ * E/S no fim da LRU, a cópia é descartada. Também é descartada se o bloco
+ * foi gravado nesse meio-tempo.
+ */
+static void prefetch_done(void *arg) {
+    struct prefetch_s *p = arg;
+
+    if (pthread_mutex_trylock(&cache_mutex) == 0) {
+        if (capacity && slot_of[p->block] == NONE && write_gen[p->block] == p->gen &&
+            (used < capacity || (!entries[lru_tail].dirty && !in_io(lru_tail)))) {
+            int slot = cache_slot(p->block);
+            memcpy(entries[slot].data, p->data, BLOCK_SIZE);
+            entries[slot].prefetched = 1;
+            cache_stats.prefetched++;
+        }
+        pthread_mutex_unlock(&cache_mutex);
+    }
+    free(p);
+}
+
+/* Leitura antecipada: pede, sem esperar, os blocos que ainda não estão na cache */
+void cache_prefetch(const uint32_t *blocks, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = blocks[i];
+        struct prefetch_s *p;
+
+        if (block >= table_blocks || dev_block_ptr(block)) continue;
+
+        pthread_mutex_lock(&cache_mutex);
+        int cached = capacity && slot_of[block] != NONE;
+        uint32_t gen = write_gen[block];
+        pthread_mutex_unlock(&cache_mutex);
+        if (cached || !(p = malloc(sizeof(struct prefetch_s) + BLOCK_SIZE))) continue;
+
+        p->block = block;
+        p->gen = gen;
+        aio_read_async(p->data, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE, prefetch_done, p);
+    }
+}
+
+void cache_print_stats() {
+    uint64_t lookups = cache_stats.hits + cache_stats.misses;
+    uint32_t dirty = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (uint32_t i = 0; i < used; i++) {
+        dirty += entries[i].dirty;
+    }
+
+    printf("Cache: %u/%u blocos (%u sujos)\n", used, capacity, dirty);
+    printf("Acertos: %llu, Faltas: %llu (%.1f%% de acerto)\n",
+           (unsigned long long)cache_stats.hits, (unsigned long long)cache_stats.misses,
+           lookups ? 100.0 * cache_stats.hits / lookups : 0.0);
+    printf("Remoções: %llu, Gravações de volta: %llu\n",
+           (unsigned long long)cache_stats.evictions, (unsigned long long)cache_stats.writebacks);
+    printf("Leituras antecipadas: %llu (úteis: %llu, descartadas sem uso: %llu)\n",
+           (unsigned long long)cache_stats.prefetched, (unsigned long long)cache_stats.prefetch_hits,
+           (unsigned long long)cache_stats.prefetch_wasted);
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,31 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+#define CACHE_DEFAULT_BLOCKS 64
+
+/* Cache de blocos write-back com substituição LRU */
+struct cache_stats_s {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+    uint64_t prefetched;
+    uint64_t prefetch_hits;
+    uint64_t prefetch_wasted;
+};
+extern struct cache_stats_s cache_stats;
+
+int cache_resize(uint32_t capacity);
+uint32_t cache_capacity();
+int cache_read(uint32_t block, uint8_t *record);
+void cache_write(uint32_t block, const uint8_t *record);
+int cache_peek(uint32_t block, uint8_t *record);
+void cache_refresh(uint32_t block, const uint8_t *record);
+void cache_prefetch(const uint32_t *blocks, uint32_t count);
+void cache_flush();
+int cache_invalidate();
+void cache_print_stats();
+
+#endif
@@ -0,0 +1,109 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "dcache.h"
+
+struct dcache_entry {
+    int valid;
+    int negative;
+    uint32_t hash;
+    char key[DCACHE_PATH_MAX];
+    struct dentry_s dentry;
+};
+
+static struct dcache_entry table[DCACHE_SLOTS];
+static uint64_t dcache_hits = 0;
+static uint64_t dcache_negative_hits = 0;
+static uint64_t dcache_misses = 0;
+static pthread_mutex_t dcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_key(const char *key) {
+    uint32_t hash = 2166136261u;
+
+    while (*key) {
+        hash = (hash ^ (uint8_t)*key++) * 16777619u;
+    }
+    return hash;
+}
+
+/* "a//b/" -> "/a/b"; a raiz vira "/" */
+void dcache_normalize(const char *path, char *key) {
+    size_t length = 0;
+
+    for (const char *p = path; *p && length < DCACHE_PATH_MAX - 2; p++) {
+        if (*p == '/') {
+            if (length > 0 && key[length - 1] == '/') continue;
+        } else if (length == 0) {
+            key[length++] = '/';
+        }
+        key[length++] = *p;
+    }
+
+    if (length > 1 && key[length - 1] == '/') length--;
+    if (length == 0) key[length++] = '/';
+    key[length] = '\0';
+}
+
+/* 1 = encontrado, -1 = sabidamente inexistente, 0 = fora da cache */
+int dcache_lookup(const char *key, struct dentry_s *dentry) {
+    uint32_t hash = hash_key(key);
+    struct dcache_entry *entry = &table[hash % DCACHE_SLOTS];
+    int result;
+
+    pthread_mutex_lock(&dcache_mutex);
+    if (!entry->valid || entry->hash != hash || strcmp(entry->key, key) != 0) {
+        dcache_misses++;
+        result = 0;
+    } else if (entry->negative) {
+        dcache_negative_hits++;
+        result = -1;
+    } else {
+        dcache_hits++;
+        *dentry = entry->dentry;
+        result = 1;
+    }
+    pthread_mutex_unlock(&dcache_mutex);
+    return result;
+}
+
+/* dentry NULL registra uma entrada negativa */
+void dcache_insert(const char *key, const struct dentry_s *dentry) {
+    uint32_t hash = hash_key(key);
+    struct dcache_entry *entry = &table[hash % DCACHE_SLOTS];
+
+    if (strlen(key) >= DCACHE_PATH_MAX) return;
+
+    pthread_mutex_lock(&dcache_mutex);
+    entry->valid = 1;
+    entry->hash = hash;
+    strcpy(entry->key, key);
+    entry->negative = (dentry == NULL);
+    if (dentry) entry->dentry = *dentry;
+    pthread_mutex_unlock(&dcache_mutex);
+}
+
+void dcache_remove(const char *key) {
+    uint32_t hash = hash_key(key);
+    struct dcache_entry *entry = &table[hash % DCACHE_SLOTS];
+
+    pthread_mutex_lock(&dcache_mutex);
+    if (entry->valid && entry->hash == hash && strcmp(entry->key, key) == 0) {
+        entry->valid = 0;
+    }
+    pthread_mutex_unlock(&dcache_mutex);
+}
+
+void dcache_reset() {
+    pthread_mutex_lock(&dcache_mutex);
+    for (int i = 0; i < DCACHE_SLOTS; i++) {
+        table[i].valid = 0;
+    }
+    pthread_mutex_unlock(&dcache_mutex);
+}
+
+void dcache_print_stats() {
+    printf("Dentries: %llu acertos, %llu acertos negativos, %llu faltas\n",
+           (unsigned long long)dcache_hits, (unsigned long long)dcache_negative_hits,
+           (unsigned long long)dcache_misses);
+}
@@ -0,0 +1,26 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+
+#define DCACHE_SLOTS      1024
+#define DCACHE_PATH_MAX   256
+
+/* Resultado da resolução de um caminho */
+struct dentry_s {
+    uint32_t parent_block;   /* diretório que contém a entrada (primeiro bloco) */
+    uint32_t entry_block;    /* bloco da cadeia do diretório com a entrada */
+    int slot;                /* posição da entrada no bloco (-1 na raiz) */
+    uint32_t block;          /* primeiro bloco do arquivo/diretório */
+    uint8_t attributes;
+};
+
+/* Cache de caminhos completos -> dentry, com entradas negativas */
+void dcache_normalize(const char *path, char *key);
+int dcache_lookup(const char *key, struct dentry_s *dentry);
+void dcache_insert(const char *key, const struct dentry_s *dentry);
+void dcache_remove(const char *key);
+void dcache_reset();
+void dcache_print_stats();
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "filesystem.h"
+#include "device.h"
+
+static int dev_fd = -1;
+static uint8_t *dev_map_base = NULL;
+
+struct dev_stats_s dev_stats;
+
+#define DEV_SIZE ((uint64_t)BLOCKS * BLOCK_SIZE)
+/* O diário fica após o último bloco, fora do mapeamento */
+#define IMAGE_SIZE (DEV_SIZE + JOURNAL_BYTES)
+
+int dev_open(const char *path, int create) {
+    int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR;
+
+    dev_close();
+
+    dev_fd = open(path, flags, 0644);
+    if (dev_fd < 0) {
+        printf("Erro: Não foi possível abrir a imagem '%s'.\n", path);
+        return -1;
+    }
+
+    if (create && ftruncate(dev_fd, (off_t)IMAGE_SIZE) < 0) {
+        printf("Erro: Não foi possível dimensionar a imagem '%s'.\n", path);
+        dev_close();
+        return -1;
+    }
+
+    return 0;
+}
+
+void dev_close() {
+    dev_unmap();
+    if (dev_fd >= 0) {
+        close(dev_fd);
+        dev_fd = -1;
+    }
+}
+
+int dev_is_open() {
+    return dev_fd >= 0;
+}
+
+/* Descritor para E/S assíncrona; -1 sem imagem ou com mmap (cópia direta) */
+int dev_descriptor() {
+    return dev_map_base ? -1 : dev_fd;
+}
+
+void dev_pread(void *buf, uint32_t len, uint64_t offset) {
+    if (dev_map_base && offset + len <= DEV_SIZE) {
+        memcpy(buf, dev_map_base + offset, len);
+        return;
+    }
+
+    ssize_t n = (dev_fd >= 0) ? pread(dev_fd, buf, len, (off_t)offset) : -1;
+
+    atomic_fetch_add(&dev_stats.reads, 1);
+    if (n > 0) atomic_fetch_add(&dev_stats.bytes_read, n);
+
+    if (n < (ssize_t)len) {
+        memset((uint8_t *)buf + (n > 0 ? n : 0), 0, len - (n > 0 ? n : 0));
+    }
+}
+
+void dev_pwrite(const void *buf, uint32_t len, uint64_t offset) {
+    if (dev_map_base && offset + len <= DEV_SIZE) {
+        memcpy(dev_map_base + offset, buf, len);
+        return;
+    }
+
+    if (dev_fd < 0 || pwrite(dev_fd, buf, len, (off_t)offset) != (ssize_t)len) {
+        printf("Erro: Falha na escrita da imagem (offset %llu).\n", (unsigned long long)offset);
+        return;
+    }
+    atomic_fetch_add(&dev_stats.writes, 1);
+    atomic_fetch_add(&dev_stats.bytes_written, len);
+}
+
+/* Blocos com números adjacentes viram uma única transferência */
+uint32_t dev_run_length(const uint32_t *blocks, uint32_t count) {
+    uint32_t run = 1;
+
+    while (run < count && blocks[run] == blocks[0] + run) {
+        run++;
+    }
+    return run;
+}
+
+void dev_read_blocks(const uint32_t *blocks, uint32_t count, uint8_t *buf) {
+    uint32_t i = 0;
+
+    while (i < count) {
+        uint32_t run = dev_run_length(&blocks[i], count - i);
+        dev_pread(buf + (size_t)i * BLOCK_SIZE, run * BLOCK_SIZE, (uint64_t)blocks[i] * BLOCK_SIZE);
+        i += run;
+    }
+}
+
+void dev_write_blocks(const uint32_t *blocks, uint32_t count, const uint8_t *buf) {
+    uint32_t i = 0;
+
+    while (i < count) {
+        uint32_t run = dev_run_length(&blocks[i], count - i);
+        dev_pwrite(buf + (size_t)i * BLOCK_SIZE, run * BLOCK_SIZE, (uint64_t)blocks[i] * BLOCK_SIZE);
+        i += run;
+    }
+}
+
+int dev_map() {
+    void *base;
+
+    if (dev_fd < 0) {
+        printf("Erro: Nenhuma imagem aberta para mapear.\n");
+        return -1;
+    }
+    if (dev_map_base) return 0;
+
+    base = mmap(NULL, DEV_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, dev_fd, 0);
+    if (base == MAP_FAILED) {
+        printf("Erro: Não foi possível mapear a imagem em memória.\n");
+        return -1;
+    }
+
+    dev_map_base = base;
+    return 0;
+}
+
+void dev_unmap() {
+    if (dev_map_base) {
+        msync(dev_map_base, DEV_SIZE, MS_SYNC);
+        munmap(dev_map_base, DEV_SIZE);
+        dev_map_base = NULL;
+    }
+}
+
+uint8_t *dev_block_ptr(uint32_t block) {
+    if (!dev_map_base || block >= BLOCKS) return NULL;
+    return dev_map_base + (size_t)block * BLOCK_SIZE;
+}
+
+void dev_sync() {
+    if (dev_map_base || dev_fd >= 0) atomic_fetch_add(&dev_stats.syncs, 1);
+    if (dev_map_base) {
+        msync(dev_map_base, DEV_SIZE, MS_SYNC);
+    } else if (dev_fd >= 0) {
+        fsync(dev_fd);
+    }
+}
+
+/* Só os dados do descritor (o diário): não espera o msync do mapeamento */
+void dev_datasync() {
+    if (dev_fd >= 0) {
+        atomic_fetch_add(&dev_stats.syncs, 1);
+        fdatasync(dev_fd);
+    }
+}
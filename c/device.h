@@ -0,0 +1,38 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include <stdint.h>
+
+/*
+ * Chamadas ao sistema feitas pela camada, inclusive as do io_uring em aio.c
+ * (bytes contados na conclusão). O mapeamento não conta leituras e gravações.
+ */
+struct dev_stats_s {
+    _Atomic uint64_t reads;
+    _Atomic uint64_t writes;
+    _Atomic uint64_t syncs;
+    _Atomic uint64_t ring_enters;   /* io_uring_enter, envio ou espera */
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t bytes_written;
+};
+extern struct dev_stats_s dev_stats;
+
+/* Camada de dispositivo: um descritor aberto por imagem, E/S posicional */
+int dev_open(const char *path, int create);
+void dev_close();
+int dev_is_open();
+int dev_descriptor();
+void dev_pread(void *buf, uint32_t len, uint64_t offset);
+void dev_pwrite(const void *buf, uint32_t len, uint64_t offset);
+uint32_t dev_run_length(const uint32_t *blocks, uint32_t count);
+void dev_read_blocks(const uint32_t *blocks, uint32_t count, uint8_t *buf);
+void dev_write_blocks(const uint32_t *blocks, uint32_t count, const uint8_t *buf);
+
+/* Backend mapeado em memória: acesso sem cópia aos blocos da imagem */
+int dev_map();
+void dev_unmap();
+uint8_t *dev_block_ptr(uint32_t block);
+void dev_sync();
+void dev_datasync();
+
+#endif
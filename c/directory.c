@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "alloc.h"
+#include "blockmap.h"
+#include "dirindex.h"
+#include "device.h"
+#include "journal.h"
+#include "directory.h"
+
+/* FNV do nome, misturado: o índice em memória usa os bits baixos do FNV puro */
+static uint32_t bucket_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < DIR_NAME_SIZE && name[i]; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    return hash ^ (hash >> 16);
+}
+
+/* Número de baldes, ou 0 se o diretório ainda é linear */
+static uint32_t hashed_buckets(uint32_t dir) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    const struct dir_entry_s *header = (const struct dir_entry_s *)view_block(dir, dir_data);
+
+    return header[0].attributes == DIR_ATTR_HASHED ? header[0].first_block : 0;
+}
+
+/* Bloco do balde do nome; os baldes vêm logo após o cabeçalho na cadeia */
+static uint32_t bucket_block(uint32_t dir, uint32_t buckets, const char *name) {
+    uint32_t block = FAT_EOF;
+
+    block_map_blocks(dir, 1 + (bucket_hash(name) & (buckets - 1)), &block, 1);
+    return block;
+}
+
+/*
+ * Blocos que guardam entradas, em ordem de cadeia: todos no layout linear,
+ * só os baldes no hash. O vetor é alocado aqui; devolve quantos.
+ */
+uint32_t dir_entry_blocks(uint32_t dir, uint32_t **blocks) {
+    uint32_t count = 0, capacity = DIR_LINEAR_BLOCKS;
+    uint32_t block = hashed_buckets(dir) ? fat[dir] : dir;
+    uint32_t *list = malloc(capacity * sizeof(uint32_t));
+
+    while (list && block < BLOCKS && count < BLOCKS) {
+        if (count == capacity) {
+            uint32_t *grown = realloc(list, 2 * capacity * sizeof(uint32_t));
+            if (!grown) break;
+            list = grown;
+            capacity *= 2;
+        }
+        list[count++] = block;
+        block = fat[block];
+    }
+    *blocks = list;
+    return list ? count : 0;
+}
+
+/* Procura name no diretório; devolve 0 e preenche pos e entry se achou */
+int dir_find(uint32_t dir, const char *name, struct dir_pos_s *pos, struct dir_entry_s *entry) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    const struct dir_entry_s *entries;
+    uint32_t buckets = hashed_buckets(dir);
+    uint32_t block = buckets ? bucket_block(dir, buckets, name) : dir;
+
+    for (uint32_t n = 0; block < BLOCKS && n < BLOCKS; n++) {
+        entries = (const struct dir_entry_s *)view_block(block, dir_data);
+        int slot = dir_lookup(block, entries, name);
+        if (slot != -1) {
+            pos->block = block;
+            pos->slot = slot;
+            if (entry) *entry = entries[slot];
+            return 0;
+        }
+        if (buckets) break;
+        block = fat[block];
+    }
+    return -1;
+}
+
+/* Procura a entrada pelo primeiro bloco: caminho lento, depois de uma troca de baldes */
+int dir_locate(uint32_t dir, uint32_t first_block, struct dir_pos_s *pos) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    uint32_t *blocks;
+    uint32_t count = dir_entry_blocks(dir, &blocks);
+    int found = -1;
+
+    for (uint32_t i = 0; i < count && found == -1; i++) {
+        const struct dir_entry_s *entries = (const struct dir_entry_s *)view_block(blocks[i], dir_data);
+
+        for (uint32_t slot = 0; slot < DIR_ENTRIES; slot++) {
+            if ((entries[slot].attributes == 0x01 || entries[slot].attributes == 0x02) &&
+                entries[slot].first_block == first_block) {
+                pos->block = blocks[i];
+                pos->slot = slot;
+                found = 0;
+                break;
+            }
+        }
+    }
+    free(blocks);
+    return found;
+}
+
+int dir_is_empty(uint32_t dir) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    uint32_t *blocks;
+    uint32_t count = dir_entry_blocks(dir, &blocks);
+    int empty = 1;
+
+    for (uint32_t i = 0; i < count && empty; i++) {
+        const struct dir_entry_s *entries = (const struct dir_entry_s *)view_block(blocks[i], dir_data);
+        empty = dir_count(blocks[i], entries) == 0;
+    }
+    free(blocks);
+    return empty;
+}
+
+/* Acrescenta um bloco zerado ao fim de um diretório linear */
+static int extend(uint32_t tail) {
+    _Alignas(uint64_t) uint8_t empty[BLOCK_SIZE];
+    int block = allocate_blocks(1);
+
+    if (block == -1) return -1;
+    link_block(tail, block);
+
+    /* Zerado também na releitura: o bloco pode ter conteúdo antigo no disco */
+    memset(empty, 0, BLOCK_SIZE);
+    journal_zero(block);
+    write_block(block, empty);
+    dir_index_drop(block);
+    return block;
+}
+
+/*
+ * Distribui as entradas (e uma vaga para name) em buckets baldes. Devolve o
+ * buffer dos baldes, ou NULL se algum transbordou.
+ */
+static uint8_t *distribute(const struct dir_entry_s *all, uint32_t count, uint32_t buckets,
+                           const char *name, struct dir_pos_s *pos) {
+    uint8_t *data = calloc(buckets, BLOCK_SIZE);
+    uint32_t *used = calloc(buckets, sizeof(uint32_t));
+    uint32_t bucket;
+
+    for (uint32_t i = 0; data && used && i < count; i++) {
+        bucket = bucket_hash((const char *)all[i].filename) & (buckets - 1);
+        if (used[bucket] == DIR_ENTRIES) goto overflow;
+        memcpy(data + (size_t)bucket * BLOCK_SIZE + used[bucket]++ * DIR_ENTRY_SIZE, &all[i], DIR_ENTRY_SIZE);
+    }
+    if (!data || !used) goto overflow;
+
+    bucket = bucket_hash(name) & (buckets - 1);
+    if (used[bucket] == DIR_ENTRIES) goto overflow;
+    pos->block = bucket;
+    pos->slot = used[bucket];
+    free(used);
+    return data;
+
+overflow:
+    free(data);
+    free(used);
+    return NULL;
+}
+
+/*
+ * Passa o diretório para buckets baldes (ou mais, até nenhum transbordar).
+ * Os baldes novos são gravados e sincronizados antes do registro que troca
+ * a cadeia: uma queda antes dele deixa o diretório antigo intacto.
+ */
+static int rebuild(uint32_t dir, uint32_t buckets, const char *name, struct dir_pos_s *pos) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    uint32_t *old_blocks, *new_blocks = NULL;
+    uint32_t old_count = dir_entry_blocks(dir, &old_blocks);
+    struct dir_entry_s *all = malloc(((size_t)old_count * DIR_ENTRIES + 1) * sizeof(struct dir_entry_s));
+    uint32_t count = 0;
+    uint8_t *data = NULL;
+    int first = -1;
+
+    for (uint32_t i = 0; all && i < old_count; i++) {
+        const struct dir_entry_s *entries = (const struct dir_entry_s *)view_block(old_blocks[i], dir_data);
+
+        for (uint32_t slot = 0; slot < DIR_ENTRIES; slot++) {
+            if (entries[slot].attributes == 0x01 || entries[slot].attributes == 0x02) {
+                all[count++] = entries[slot];
+            }
+        }
+    }
+
+    while (all && buckets <= DIR_MAX_BUCKETS && !(data = distribute(all, count, buckets, name, pos))) {
+        buckets *= 2;
+    }
+    if (!data) {
+        printf("Erro: O diretório atingiu o limite de entradas.\n");
+        goto out;
+    }
+
+    first = allocate_blocks(buckets);
+    if (first == -1 || !(new_blocks = malloc(buckets * sizeof(uint32_t)))) {
+        if (first != -1) free_chain(first);
+        first = -1;
+        goto out;
+    }
+    chain_blocks(first, new_blocks, buckets);
+    for (uint32_t i = 0; i < buckets; i++) {
+        dir_index_drop(new_blocks[i]);
+    }
+    write_chain(new_blocks, buckets, data, NULL);
+    dev_datasync();
+
+    /* Troca: o cabeçalho passa a apontar para os baldes novos */
+    uint32_t old_tail = fat[dir];
+    struct dir_entry_s *header = (struct dir_entry_s *)dir_data;
+
+    link_block(dir, first);
+    if (old_tail != FAT_EOF) free_chain(old_tail);
+
+    memset(dir_data, 0, BLOCK_SIZE);
+    header->attributes = DIR_ATTR_HASHED;
+    header->first_block = buckets;
+    journal_zero(dir);
+    journal_dir(dir, 0, header);
+    journal_split();
+    write_block(dir, dir_data);
+
+    for (uint32_t i = 0; i < old_count; i++) {
+        dir_index_drop(old_blocks[i]);
+    }
+    block_map_drop(dir);
+    pos->block = new_blocks[pos->block];
+
+out:
+    free(old_blocks);
+    free(new_blocks);
+    free(all);
+    free(data);
+    return first == -1 ? -1 : 0;
+}
+
+/*
+ * Vaga para name no diretório, dentro da operação do diário de quem chama.
+ * Um diretório linear cheio ganha um bloco ou, no limite, passa a baldes;
+ * um balde cheio dobra os baldes.
+ */
+int dir_reserve(uint32_t dir, const char *name, struct dir_pos_s *pos) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    const struct dir_entry_s *entries;
+    uint32_t buckets = hashed_buckets(dir);
+    uint32_t block, tail = dir, length = 0;
+
+    if (buckets) {
+        block = bucket_block(dir, buckets, name);
+        entries = (const struct dir_entry_s *)view_block(block, dir_data);
+        pos->slot = dir_free_slot(block, entries);
+        if (pos->slot == -1) return rebuild(dir, buckets * 2, name, pos);
+        pos->block = block;
+        return 0;
+    }
+
+    for (block = dir; block < BLOCKS; block = fat[block]) {
+        entries = (const struct dir_entry_s *)view_block(block, dir_data);
+        pos->slot = dir_free_slot(block, entries);
+        if (pos->slot != -1) {
+            pos->block = block;
+            return 0;
+        }
+        tail = block;
+        length++;
+    }
+
+    if (length < DIR_LINEAR_BLOCKS) {
+        int added = extend(tail);
+        if (added == -1) return -1;
+        pos->block = added;
+        pos->slot = 0;
+        return 0;
+    }
+    /* Metade dos baldes ocupada de início */
+    for (buckets = 1; buckets < 2 * length; buckets *= 2);
+    return rebuild(dir, buckets, name, pos);
+}
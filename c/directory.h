@@ -0,0 +1,33 @@
+#ifndef DIRECTORY_H
+#define DIRECTORY_H
+
+#include <stdint.h>
+#include "filesystem.h"
+
+#define DIR_ATTR_HASHED   0x04
+#define DIR_LINEAR_BLOCKS 8
+#define DIR_MAX_BUCKETS   (1u << 20)
+
+/*
+ * Um diretório é uma cadeia de blocos cujo primeiro bloco o identifica.
+ * Até DIR_LINEAR_BLOCKS blocos as entradas ocupam qualquer posição livre
+ * e a consulta passa pelo índice de cada bloco. Acima disso o primeiro
+ * bloco vira cabeçalho (entrada 0 com DIR_ATTR_HASHED e o número de baldes
+ * em first_block) e os demais são baldes: cada nome fica no balde do seu
+ * hash, e a consulta lê um só bloco. Um balde cheio dobra os baldes.
+ *
+ * As funções recebem o primeiro bloco do diretório, com a trava dele
+ * (de escrita para dir_reserve).
+ */
+struct dir_pos_s {
+    uint32_t block;    /* bloco da cadeia que guarda a entrada */
+    int slot;
+};
+
+int dir_find(uint32_t dir, const char *name, struct dir_pos_s *pos, struct dir_entry_s *entry);
+int dir_locate(uint32_t dir, uint32_t first_block, struct dir_pos_s *pos);
+int dir_reserve(uint32_t dir, const char *name, struct dir_pos_s *pos);
+uint32_t dir_entry_blocks(uint32_t dir, uint32_t **blocks);
+int dir_is_empty(uint32_t dir);
+
+#endif
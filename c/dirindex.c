@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "dirindex.h"
+#include "stats.h"
+
+#define USED_WORDS ((DIR_ENTRIES + 63) / 64)
+
+struct dir_index_s {
+    int valid;
+    uint32_t block;
+    uint64_t *used;                 /* bit i = entrada i ocupada */
+    int32_t *table;                 /* entrada ou -1, sondagem linear */
+};
+
+static struct dir_index_s indexes[DIR_INDEX_SLOTS];
+/* Entradas por bloco para as quais as tabelas foram alocadas */
+static uint32_t index_entries = 0;
+/* Leitores do mesmo diretório podem montar o índice ao mesmo tempo */
+static pthread_mutex_t index_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+
+    for (int i = 0; i < DIR_NAME_SIZE && name[i]; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void index_add(struct dir_index_s *index, const struct dir_entry_s *entries, int slot) {
+    uint32_t h = hash_name((const char *)entries[slot].filename) % DIR_HASH_SIZE;
+
+    while (index->table[h] != -1) {
+        h = (h + 1) % DIR_HASH_SIZE;
+    }
+    index->table[h] = slot;
+    index->used[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+static void index_build(struct dir_index_s *index, uint32_t block, const struct dir_entry_s *entries) {
+    STAT_INC(STAT_DIR_INDEX_BUILD);
+    index->valid = 1;
+    index->block = block;
+    memset(index->used, 0, USED_WORDS * sizeof(uint64_t));
+    memset(index->table, -1, DIR_HASH_SIZE * sizeof(int32_t));
+
+    for (uint32_t i = 0; i < DIR_ENTRIES; i++) {
+        if (entries[i].attributes != 0x00) {
+            index_add(index, entries, i);
+        }
+    }
+}
+
+/*
+ * Índice do diretório, montado a partir de entries se ainda não existir.
+ * As tabelas do slot são alocadas no primeiro uso; sem memória devolve
+ * NULL e quem chamou percorre as entradas.
+ */
+static struct dir_index_s *index_get(uint32_t block, const struct dir_entry_s *entries) {
+    struct dir_index_s *index = &indexes[block % DIR_INDEX_SLOTS];
+
+    if (!index->table) {
+        index->used = malloc(USED_WORDS * sizeof(uint64_t));
+        index->table = malloc(DIR_HASH_SIZE * sizeof(int32_t));
+        if (!index->used || !index->table) {
+            free(index->used);
+            free(index->table);
+            index->used = NULL;
+            index->table = NULL;
+            return NULL;
+        }
+        index->valid = 0;
+    }
+
+    if (!index->valid || index->block != block) {
+        index_build(index, block, entries);
+    }
+    return index;
+}
+
+int dir_lookup(uint32_t block, const struct dir_entry_s *entries, const char *name) {
+    uint32_t h = hash_name(name) % DIR_HASH_SIZE;
+    int found = -1;
+
+    STAT_INC(STAT_DIR_PROBE);
+    pthread_mutex_lock(&index_mutex);
+    struct dir_index_s *index = index_get(block, entries);
+    if (!index) {
+        for (uint32_t i = 0; i < DIR_ENTRIES && found == -1; i++) {
+            if (entries[i].attributes != 0x00 &&
+                strncmp((const char *)entries[i].filename, name, DIR_NAME_SIZE) == 0) {
+                found = i;
+            }
+        }
+        pthread_mutex_unlock(&index_mutex);
+        return found;
+    }
+    while (index->table[h] != -1) {
+        int slot = index->table[h];
+        if (strncmp((const char *)entries[slot].filename, name, DIR_NAME_SIZE) == 0) {
+            found = slot;
+            break;
+        }
+        h = (h + 1) % DIR_HASH_SIZE;
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return found;
+}
+
+int dir_free_slot(uint32_t block, const struct dir_entry_s *entries) {
+    int slot = -1;
+
+    STAT_INC(STAT_DIR_PROBE);
+    pthread_mutex_lock(&index_mutex);
+    struct dir_index_s *index = index_get(block, entries);
+    for (uint32_t w = 0; index && w < USED_WORDS && slot == -1; w++) {
+        uint64_t free_bits = ~index->used[w];
+
+        if (free_bits && w * 64 + __builtin_ctzll(free_bits) < DIR_ENTRIES) {
+            slot = w * 64 + __builtin_ctzll(free_bits);
+        }
+    }
+    for (uint32_t i = 0; !index && i < DIR_ENTRIES && slot == -1; i++) {
+        if (entries[i].attributes == 0x00) slot = i;
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return slot;
+}
+
+int dir_count(uint32_t block, const struct dir_entry_s *entries) {
+    int count = 0;
+
+    pthread_mutex_lock(&index_mutex);
+    struct dir_index_s *index = index_get(block, entries);
+    for (uint32_t i = 0; i < (index ? USED_WORDS : DIR_ENTRIES); i++) {
+        if (index) count += __builtin_popcountll(index->used[i]);
+        else count += entries[i].attributes != 0x00;
+    }
+    pthread_mutex_unlock(&index_mutex);
+    return count;
+}
+
+void dir_index_insert(uint32_t block, const struct dir_entry_s *entries, int slot) {
+    struct dir_index_s *index = &indexes[block % DIR_INDEX_SLOTS];
+
+    pthread_mutex_lock(&index_mutex);
+    if (index->valid && index->block == block) {
+        index_add(index, entries, slot);
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+/* Remoção em sondagem linear: mais simples remontar as entradas do bloco */
+void dir_index_remove(uint32_t block, const struct dir_entry_s *entries, int slot) {
+    struct dir_index_s *index = &indexes[block % DIR_INDEX_SLOTS];
+
+    (void)slot;
+    pthread_mutex_lock(&index_mutex);
+    if (index->valid && index->block == block) {
+        index_build(index, block, entries);
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+void dir_index_drop(uint32_t block) {
+    struct dir_index_s *index = &indexes[block % DIR_INDEX_SLOTS];
+
+    pthread_mutex_lock(&index_mutex);
+    if (index->block == block) {
+        index->valid = 0;
+    }
+    pthread_mutex_unlock(&index_mutex);
+}
+
+/* Esvazia os índices; com outra geometria as tabelas são realocadas no uso */
+void dir_index_reset() {
+    pthread_mutex_lock(&index_mutex);
+    for (int i = 0; i < DIR_INDEX_SLOTS; i++) {
+        indexes[i].valid = 0;
+        if (index_entries != DIR_ENTRIES) {
+            free(indexes[i].used);
+            free(indexes[i].table);
+            indexes[i].used = NULL;
+            indexes[i].table = NULL;
+        }
+    }
+    index_entries = DIR_ENTRIES;
+    pthread_mutex_unlock(&index_mutex);
+}
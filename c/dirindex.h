@@ -0,0 +1,22 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <stdint.h>
+#include "filesystem.h"
+
+#define DIR_INDEX_SLOTS   128
+#define DIR_HASH_SIZE     (DIR_ENTRIES * 2)
+
+/*
+ * Índice em memória nome -> entrada de um diretório, montado na primeira
+ * consulta ao bloco e atualizado pelas operações que alteram o diretório.
+ */
+int dir_lookup(uint32_t block, const struct dir_entry_s *entries, const char *name);
+int dir_free_slot(uint32_t block, const struct dir_entry_s *entries);
+int dir_count(uint32_t block, const struct dir_entry_s *entries);
+void dir_index_insert(uint32_t block, const struct dir_entry_s *entries, int slot);
+void dir_index_remove(uint32_t block, const struct dir_entry_s *entries, int slot);
+void dir_index_drop(uint32_t block);
+void dir_index_reset();
+
+#endif
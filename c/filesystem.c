@@ -1,217 +1,642 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include "filesystem.h"
+#include "device.h"
+#include "cache.h"
+#include "alloc.h"
+#include "dirindex.h"
+#include "dcache.h"
+#include "blockmap.h"
+#include "locks.h"
+#include "aio.h"
+#include "readahead.h"
+#include "journal.h"
+#include "fsck.h"
+#include "directory.h"
+#include "snapshot.h"
+#include "stats.h"
+
+struct geometry_s geometry;
+uint32_t *fat = NULL;
+struct dir_entry_s *dir_block = NULL;
+static char (*block_names)[DIR_NAME_SIZE] = NULL;
+static pthread_mutex_t export_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Marcados por set_fat sob a trava de um grupo, limpos por write_fat */
+static atomic_uchar *fat_dirty = NULL;
+static _Atomic uint64_t fat_sector_writes = 0;
+int fat_deferred = 0;
+/* Modo batch: sem as mensagens de sucesso */
+int quiet = 0;
+uint32_t root_dir = 0;
+int read_only = 0;
+
+void read_block(uint32_t block, uint8_t *record) {
+    STAT_INC(STAT_READ_BLOCK);
+    if (dev_block_ptr(block)) {
+        dev_pread(record, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+    } else {
+        cache_read(block, record);
+    }
+}
 
-uint16_t fat[BLOCKS];
-uint8_t data_block[BLOCK_SIZE];
-struct dir_entry_s dir_block[DIR_ENTRIES];
-char block_names[BLOCKS][26];
+void write_block(uint32_t block, uint8_t *record) {
+    STAT_INC(STAT_WRITE_BLOCK);
+    if (dev_block_ptr(block)) {
+        /*
+         * O kernel pode levar a página mapeada ao disco a qualquer momento:
+         * o registro que a descreve fica durável antes da cópia (regra do
+         * WAL). Com a FAT adiada o diário só é forçado na descarga.
+         */
+        if (journal_enabled() && !fat_deferred) journal_force();
+        dev_pwrite(record, BLOCK_SIZE, (uint64_t)block * BLOCK_SIZE);
+    } else {
+        cache_write(block, record);
+    }
+}
 
-void read_block(char *file, uint32_t block, uint8_t *record) {
-    FILE *f = fopen(file, "r+");
-    fseek(f, block * BLOCK_SIZE, SEEK_SET);
-    fread(record, 1, BLOCK_SIZE, f);
-    fclose(f);
+/* Descarrega a cache e a imagem antes de trocar ou fechar o dispositivo */
+void flush_filesystem() {
+    if (read_only || !dev_is_open()) return;
+    if (journal_enabled()) {
+        journal_checkpoint();
+        return;
+    }
+    write_fat(fat);
+    cache_flush();
+    dev_sync();
 }
 
-void write_block(char *file, uint32_t block, uint8_t *record) {
-    FILE *f = fopen(file, "r+");
-    fseek(f, block * BLOCK_SIZE, SEEK_SET);
-    fwrite(record, 1, BLOCK_SIZE, f);
-    fclose(f);
+/* Um snapshot montado não aceita alterações */
+int writable() {
+    if (read_only) printf("Erro: Snapshot montado somente para leitura.\n");
+    return !read_only;
 }
 
-void read_fat(char *file, uint16_t *fat) {
-    FILE *f = fopen(file, "r+");
-    fseek(f, 0, SEEK_SET);
-    fread(fat, sizeof(uint16_t), BLOCKS, f);
-    fclose(f);
+/*
+ * Adota a geometria e realoca as estruturas que dependem dela. Chamar sem a
+ * imagem anterior em uso; em caso de erro a geometria atual é mantida.
+ */
+static int set_geometry(uint32_t block_size, uint32_t blocks) {
+    uint32_t fat_blocks, fat_entries;
+    uint32_t *new_fat;
+    atomic_uchar *new_dirty;
+    char (*new_names)[DIR_NAME_SIZE];
+    struct dir_entry_s *new_dir;
+
+    if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE || (block_size & (block_size - 1))) {
+        printf("Erro: Tamanho de bloco %u inválido (potência de 2 entre %u e %u).\n",
+               block_size, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE);
+        return -1;
+    }
+
+    fat_blocks = (uint32_t)(((uint64_t)blocks * 4 + block_size - 1) / block_size);
+    if (blocks > MAX_BLOCKS || blocks < FAT_START + fat_blocks + 2) {
+        printf("Erro: Número de blocos %u inválido (máximo %u).\n", blocks, MAX_BLOCKS);
+        return -1;
+    }
+
+    /* A FAT cobre setores inteiros: as entradas após o último bloco ficam zeradas */
+    fat_entries = fat_blocks * (block_size / 4);
+    new_fat = calloc(fat_entries, sizeof(uint32_t));
+    new_dirty = calloc(fat_blocks, sizeof(atomic_uchar));
+    new_names = malloc((size_t)blocks * DIR_NAME_SIZE);
+    new_dir = malloc(block_size);
+    if (!new_fat || !new_dirty || !new_names || !new_dir) {
+        free(new_fat);
+        free(new_dirty);
+        free(new_names);
+        free(new_dir);
+        printf("Erro: Memória insuficiente para %u blocos.\n", blocks);
+        return -1;
+    }
+
+    free(fat);
+    free((void *)fat_dirty);
+    free(block_names);
+    free(dir_block);
+    fat = new_fat;
+    fat_dirty = new_dirty;
+    block_names = new_names;
+    dir_block = new_dir;
+
+    geometry.block_size = block_size;
+    geometry.blocks = blocks;
+    geometry.fat_blocks = fat_blocks;
+    geometry.root_block = FAT_START + fat_blocks;
+    return 0;
 }
 
-void write_fat(char *file, uint16_t *fat) {
-    FILE *f = fopen(file, "r+");
-    fseek(f, 0, SEEK_SET);
-    fwrite(fat, 2, BLOCKS, f);
-    fclose(f);
+static void write_superblock() {
+    _Alignas(uint64_t) uint8_t block[BLOCK_SIZE];
+    struct superblock_s sb = {
+        SUPERBLOCK_MAGIC, SUPERBLOCK_VERSION, BLOCK_SIZE, BLOCKS,
+        FAT_START, FAT_BLOCKS, ROOT_BLOCK, JOURNAL_BYTES, JOURNAL_OFFSET
+    };
+
+    memset(block, 0, BLOCK_SIZE);
+    memcpy(block, &sb, sizeof(sb));
+    dev_pwrite(block, BLOCK_SIZE, 0);
 }
 
-void init_filesystem() {
-    FILE *f;
-    int i;
+/* Lê o superbloco da imagem recém-aberta e adota a geometria dela */
+static int read_superblock() {
+    struct superblock_s sb;
 
-    f = fopen("filesystem.dat", "w+");
-    fclose(f);
+    dev_pread(&sb, sizeof(sb), 0);
+    if (sb.magic != SUPERBLOCK_MAGIC) {
+        printf("Erro: A imagem não tem superbloco (formato antigo ou corrompida).\n");
+        return -1;
+    }
+    if (sb.version != SUPERBLOCK_VERSION || sb.fat_start != FAT_START || sb.journal_bytes != JOURNAL_BYTES) {
+        printf("Erro: Versão de imagem não suportada.\n");
+        return -1;
+    }
+    if (set_geometry(sb.block_size, sb.blocks) == -1) return -1;
+    if (sb.fat_blocks != FAT_BLOCKS || sb.root_block != ROOT_BLOCK || sb.journal_offset != JOURNAL_OFFSET) {
+        printf("Erro: Superbloco inconsistente.\n");
+        return -1;
+    }
+    return 0;
+}
 
-    for (i = 0; i < FAT_BLOCKS; i++) {
-        fat[i] = 0x7ffe;
+/*
+ * Descarrega a imagem anterior e abre a nova. Na criação a geometria vem do
+ * chamador; na carga, do superbloco. As caches só são refeitas depois, já
+ * com a geometria da imagem nova.
+ */
+static int open_image(const char *image, int create, int mapped, uint32_t block_size, uint32_t blocks) {
+    aio_drain();
+    /* O diário da imagem anterior é esvaziado antes da troca */
+    if (dev_is_open() && journal_enabled() && !read_only) journal_checkpoint();
+    cache_flush();
+    dev_close();
+    read_only = 0;
+
+    if (create && set_geometry(block_size, blocks) == -1) return -1;
+    if (dev_open(image, create) == -1) return -1;
+    int failed = !create && read_superblock() == -1;
+
+    root_dir = ROOT_BLOCK;
+    if (cache_invalidate() == -1 || alloc_reset() == -1 || snapshot_reset() == -1) failed = 1;
+    dir_index_reset();
+    dcache_reset();
+    block_map_reset();
+    ra_reset();
+
+    if (failed) {
+        dev_close();
+        return -1;
     }
-    fat[ROOT_BLOCK] = 0x7fff;
+    if (mapped && dev_map() == -1) return -1;
+    return 0;
+}
 
-    for (i = ROOT_BLOCK + 1; i < BLOCKS; i++) {
-        fat[i] = 0x0000;
+/* Acesso sem cópia: aponta para o bloco mapeado ou, sem mmap, copia em buf */
+const uint8_t *view_block(uint32_t block, uint8_t *buf) {
+    uint8_t *mapped = dev_block_ptr(block);
+
+    if (mapped) return mapped;
+    read_block(block, buf);
+    return buf;
+}
+
+/* Copia até max blocos da cadeia a partir de block; devolve quantos */
+uint32_t chain_blocks(uint32_t block, uint32_t *blocks, uint32_t max) {
+    uint32_t count = 0;
+
+    while (count < max && block < BLOCKS) {
+        blocks[count++] = block;
+        block = fat[block];
     }
+    return count;
+}
 
-    write_fat("filesystem.dat", fat);
+/*
+ * E/S de cadeia: blocos adjacentes viram um só pedido, e os pedidos vão
+ * juntos para a fila assíncrona. read_chain_submit dispara a leitura e
+ * read_chain_wait a conclui; no meio o chamador pode processar outro lote.
+ * Blocos já na cache (por exemplo, lidos antecipadamente) não vão ao disco.
+ */
+void read_chain_submit(const uint32_t *blocks, uint32_t count, uint8_t *buf, struct aio_batch_s *batch) {
+    uint32_t i = 0;
 
-    memset(data_block, 0, BLOCK_SIZE);
+    STAT_ADD(STAT_CHAIN_READ, count);
 
-    write_block("filesystem.dat", ROOT_BLOCK, data_block);
+    while (i < count) {
+        uint32_t run = 0;
+        int hit = 0;
 
-    for (i = ROOT_BLOCK + 1; i < BLOCKS; i++) {
-        write_block("filesystem.dat", i, data_block);
+        while (i + run < count && (run == 0 || blocks[i + run] == blocks[i] + run)) {
+            if ((hit = cache_peek(blocks[i + run], buf + (size_t)(i + run) * BLOCK_SIZE))) break;
+            run++;
+        }
+        if (run) aio_read(batch, buf + (size_t)i * BLOCK_SIZE, run * BLOCK_SIZE, (uint64_t)blocks[i] * BLOCK_SIZE);
+        i += run + hit;
     }
+    aio_submit(batch);
+}
 
-    printf("Sistema de arquivos inicializado.\n");
+void read_chain_wait(const uint32_t *blocks, uint32_t count, uint8_t *buf, struct aio_batch_s *batch) {
+    aio_wait(batch);
+
+    /* A cache pode ter cópias mais novas que o disco */
+    for (uint32_t i = 0; i < count; i++) {
+        cache_peek(blocks[i], buf + (size_t)i * BLOCK_SIZE);
+    }
 }
 
-int allocate_blocks(int num_blocks) {
-    int first_block = -1;
-    int last_allocated = -1;
-    int blocks_allocated = 0;
+void read_chain(const uint32_t *blocks, uint32_t count, uint8_t *buf) {
+    struct aio_batch_s batch = {0};
 
-    for (int i = ROOT_BLOCK + 1; i < BLOCKS && blocks_allocated < num_blocks; i++) {
-        if (fat[i] == 0x0000) {
-            if (first_block == -1) {
-                first_block = i;
-            } else {
-                fat[last_allocated] = i;
-            }
-            last_allocated = i;
-            blocks_allocated++;
-        }
+    read_chain_submit(blocks, count, buf, &batch);
+    read_chain_wait(blocks, count, buf, &batch);
+}
+
+/* Com batch, só envia: o buffer precisa viver até aio_wait(batch) */
+void write_chain(const uint32_t *blocks, uint32_t count, const uint8_t *buf, struct aio_batch_s *batch) {
+    struct aio_batch_s own = {0};
+
+    STAT_ADD(STAT_CHAIN_WRITE, count);
+    /* Cópias limpas antes da escrita: um flush concorrente não as regrava */
+    for (uint32_t i = 0; i < count; i++) {
+        cache_refresh(blocks[i], buf + (size_t)i * BLOCK_SIZE);
     }
 
-    if (blocks_allocated == num_blocks) {
-        fat[last_allocated] = 0x7fff;
-        return first_block;
-    } else {
-        printf("Erro: Não há blocos suficientes disponíveis.\n");
-        return -1;
+    aio_write_blocks(batch ? batch : &own, blocks, count, buf);
+    if (batch) aio_submit(batch);
+    else aio_wait(&own);
+}
+
+void read_fat(uint32_t *fat) {
+    dev_pread(fat, FAT_BLOCKS * BLOCK_SIZE, (uint64_t)FAT_START * BLOCK_SIZE);
+    for (uint32_t i = 0; i < FAT_BLOCKS; i++) {
+        atomic_store(&fat_dirty[i], 0);
     }
 }
 
-int find_file_block(const char *path) {
-    struct dir_entry_s entry;
-    char temp_path[256];
-    char *token;
-    uint32_t current_block = ROOT_BLOCK;
-
-    strncpy(temp_path, path, sizeof(temp_path));
-    temp_path[sizeof(temp_path) - 1] = '\0';
-
-    token = strtok(temp_path, "/");
-    while (token != NULL) {
-        int found = 0;
-
-        read_block("filesystem.dat", current_block, data_block);
-
-        for (int i = 0; i < DIR_ENTRIES; i++) {
-            memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-
-            if (strncmp((const char *)entry.filename, token, 25) == 0) {
-                if (entry.attributes == 0x01) { 
-                    if ((token = strtok(NULL, "/")) == NULL) {
-                        return entry.first_block;
-                    } else {
-                        printf("Erro: '%s' é um arquivo, não um diretório.\n", token);
-                        return -1;
-                    }
-                } else if (entry.attributes == 0x02) {
-                    current_block = entry.first_block;
-                    found = 1;
-                    break;
-                }
-            }
-        }
+/*
+ * Grava apenas os setores da FAT alterados desde a última gravação. Cada
+ * setor é gravado com as travas dos grupos que o compõem, sem bloquear
+ * alocações nos demais.
+ */
+void write_fat(uint32_t *fat) {
+    /* Montada, a FAT em memória é a do snapshot */
+    if (read_only) return;
 
-        if (!found) {
-            printf("Erro: Caminho '%s' não encontrado no diretório '%s'.\n", path, token);
-            return -1;
-        }
+    for (uint32_t i = 0; i < FAT_BLOCKS; i++) {
+        uint32_t first = i * FAT_ENTRIES_PER_BLOCK;
+        uint32_t end = first + FAT_ENTRIES_PER_BLOCK < BLOCKS ? first + FAT_ENTRIES_PER_BLOCK : BLOCKS;
 
-        token = strtok(NULL, "/");
+        if (!atomic_load(&fat_dirty[i])) continue;
+
+        for (uint32_t b = first; b < end; b += ALLOC_GROUP_BLOCKS) {
+            alloc_group_lock(b);
+        }
+        if (atomic_exchange(&fat_dirty[i], 0)) {
+            dev_pwrite(&fat[first], BLOCK_SIZE, (uint64_t)(FAT_START + i) * BLOCK_SIZE);
+            atomic_fetch_add(&fat_sector_writes, 1);
+            STAT_INC(STAT_FAT_SECTOR);
+        }
+        for (uint32_t b = first; b < end; b += ALLOC_GROUP_BLOCKS) {
+            alloc_group_unlock(b);
+        }
     }
+}
 
-    printf("Erro: Arquivo '%s' não encontrado.\n", path);
-    return -1;
+/* Chamar com a trava do grupo do bloco: a FAT e o bitmap mudam juntos */
+void set_fat(uint32_t block, uint32_t value) {
+    STAT_INC(STAT_FAT_SET);
+    if ((fat[block] == FAT_FREE) != (value == FAT_FREE)) {
+        free_map_update(block, value == FAT_FREE);
+    }
+    fat[block] = value;
+    atomic_store(&fat_dirty[block / FAT_ENTRIES_PER_BLOCK], 1);
+    journal_fat(block, value);
 }
 
-void load_filesystem() {
-    read_fat("filesystem.dat", fat);
+/*
+ * Fim de operação: com o diário, espera o registro ficar durável (a FAT vai
+ * para o lugar no checkpoint); sem ele, grava a FAT. Adiada, a operação só
+ * fica durável na próxima descarga.
+ */
+void commit_fat() {
+    if (journal_enabled()) journal_commit();
+    else if (!fat_deferred) write_fat(fat);
+}
 
-    read_block("filesystem.dat", ROOT_BLOCK, data_block);
-    memcpy(dir_block, data_block, sizeof(dir_block));
+void print_fat_stats() {
+    int dirty = 0;
 
-    printf("Sistema de arquivos carregado.\n");
+    for (uint32_t i = 0; i < FAT_BLOCKS; i++) {
+        dirty += atomic_load(&fat_dirty[i]);
+    }
+    printf("Setores da FAT: %u (%d sujos), gravações de setor: %llu, gravação adiada: %s\n",
+           FAT_BLOCKS, dirty, (unsigned long long)atomic_load(&fat_sector_writes), fat_deferred ? "sim" : "não");
 }
 
-int find_directory_block(const char *path) {
-    struct dir_entry_s entry;
-    char temp_path[256];
-    char *token;
-    uint32_t current_block = ROOT_BLOCK;
+void init_filesystem(const char *image, int mapped, uint32_t block_size, uint32_t blocks) {
+    uint32_t i;
 
-    strncpy(temp_path, path, sizeof(temp_path));
-    temp_path[sizeof(temp_path) - 1] = '\0';
+    ns_lock_write();
+    if (open_image(image, 1, mapped, block_size, blocks) == -1) {
+        ns_unlock();
+        return;
+    }
 
-    token = strtok(temp_path, "/");
-    while (token != NULL) {
-        int found = 0;
+    _Alignas(uint64_t) uint8_t root[BLOCK_SIZE];
+    memset(root, 0, BLOCK_SIZE);
+    write_superblock();
 
-        read_block("filesystem.dat", current_block, data_block);
+    /* Superbloco e setores da FAT */
+    for (i = 0; i < ROOT_BLOCK; i++) {
+        fat[i] = FAT_RESERVED;
+    }
+    fat[ROOT_BLOCK] = FAT_EOF;
 
-        for (int i = 0; i < DIR_ENTRIES; i++) {
-            memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
+    for (i = ROOT_BLOCK + 1; i < BLOCKS; i++) {
+        fat[i] = FAT_FREE;
+    }
+
+    for (i = 0; i < FAT_BLOCKS; i++) {
+        atomic_store(&fat_dirty[i], 1);
+    }
+    write_fat(fat);
+    free_map_build();
+    journal_format();
+
+    /* A imagem recém-dimensionada já está zerada; só a raiz é gravada */
+    write_block(ROOT_BLOCK, root);
+    ns_unlock();
+
+    if (!quiet) printf("Sistema de arquivos inicializado (%u blocos de %u bytes).\n", BLOCKS, BLOCK_SIZE);
+}
 
-            if (entry.attributes == 0x02 && strncmp((const char *)entry.filename, token, 25) == 0) {
-                current_block = entry.first_block;
-                found = 1;
-                break;
+/*
+ * Resolve o caminho componente a componente, consultando primeiro o cache
+ * de dentries para cada prefixo e só lendo blocos de diretório nas faltas.
+ */
+int resolve_path(const char *path, struct dentry_s *dentry) {
+    char key[DCACHE_PATH_MAX];
+    struct dentry_s current = { root_dir, root_dir, -1, root_dir, 0x02 };
+    size_t position = 1;
+
+    dcache_normalize(path, key);
+
+    switch (dcache_lookup(key, dentry)) {
+    case 1:
+        return RESOLVE_OK;
+    case -1:
+        return RESOLVE_MISSING;
+    }
+
+    while (key[position] != '\0') {
+        char *slash = strchr(&key[position], '/');
+        size_t end = slash ? (size_t)(slash - key) : strlen(key);
+        char saved = key[end];
+        struct dentry_s next;
+
+        if (current.attributes != 0x02) return RESOLVE_NOT_DIR;
+
+        key[end] = '\0';
+        int cached = dcache_lookup(key, &next);
+        if (cached == -1) return RESOLVE_MISSING;
+        if (cached == 0) {
+            struct dir_pos_s pos;
+            struct dir_entry_s entry;
+
+            /* A consulta e o registro na cache ficam sob a mesma trava */
+            dir_lock_read(current.block);
+            if (dir_find(current.block, &key[position], &pos, &entry) == -1) {
+                dcache_insert(key, NULL);
+                dir_unlock(current.block);
+                return RESOLVE_MISSING;
             }
+
+            next.parent_block = current.block;
+            next.entry_block = pos.block;
+            next.slot = pos.slot;
+            next.block = entry.first_block;
+            next.attributes = entry.attributes;
+            dcache_insert(key, &next);
+            dir_unlock(current.block);
         }
+        key[end] = saved;
 
-        if (!found) {
-            return -1;
+        current = next;
+        position = saved ? end + 1 : end;
+    }
+
+    *dentry = current;
+    return RESOLVE_OK;
+}
+
+/* Como find_file_block, mas devolve também a dentry (diretório pai e entrada) */
+static int find_file(const char *path, struct dentry_s *dentry) {
+    switch (resolve_path(path, dentry)) {
+    case RESOLVE_NOT_DIR:
+        printf("Erro: Um componente de '%s' é um arquivo, não um diretório.\n", path);
+        return -1;
+    case RESOLVE_MISSING:
+        printf("Erro: Caminho '%s' não encontrado.\n", path);
+        return -1;
+    }
+
+    if (dentry->attributes != 0x01) {
+        printf("Erro: Arquivo '%s' não encontrado.\n", path);
+        return -1;
+    }
+    return dentry->block;
+}
+
+int find_file_block(const char *path) {
+    struct dentry_s dentry;
+
+    return find_file(path, &dentry);
+}
+
+/*
+ * Com snapshot, a imagem viva é carregada (e o diário reaplicado) e depois
+ * a FAT em memória passa a ser a do snapshot, somente para leitura.
+ */
+/*
+ * Fecha a imagem sem gravar nada (a FAT em memória pode estar pela metade)
+ * e volta ao estado de nenhuma imagem carregada
+ */
+static void discard_image() {
+    dev_close();
+    root_dir = ROOT_BLOCK;
+    cache_invalidate();
+    alloc_reset();
+    snapshot_reset();
+    dir_index_reset();
+    dcache_reset();
+    block_map_reset();
+    ra_reset();
+    memset(dir_block, 0, BLOCK_SIZE);
+}
+
+void load_filesystem(const char *image, int mapped, const char *snapshot) {
+    int root = -1;
+
+    ns_lock_write();
+    if (open_image(image, 0, mapped, 0, 0) == -1) {
+        ns_unlock();
+        return;
+    }
+
+    read_fat(fat);
+    journal_replay();
+    /* Os blocos retidos pelos snapshots ficam fora do mapa de livres */
+    snapshot_load();
+    free_map_build();
+
+    if (snapshot) {
+        /* Quem pediu uma vista somente para leitura não recebe a imagem viva */
+        if ((root = snapshot_mount(snapshot)) == -1) {
+            discard_image();
+            ns_unlock();
+            return;
         }
+        root_dir = root;
+        read_only = 1;
+        alloc_reset();
+        dir_index_reset();
+        dcache_reset();
+        block_map_reset();
+        ra_reset();
+    }
+
+    read_block(root_dir, (uint8_t *)dir_block);
+    ns_unlock();
 
-        token = strtok(NULL, "/");
+    if (quiet) return;
+    if (snapshot) printf("Snapshot '%s' carregado somente para leitura.\n", snapshot);
+    else printf("Sistema de arquivos carregado.\n");
+}
+
+int find_directory_block(const char *path) {
+    struct dentry_s dentry;
+
+    if (resolve_path(path, &dentry) != RESOLVE_OK || dentry.attributes != 0x02) {
+        return -1;
     }
+    return dentry.block;
+}
 
-    return current_block;
+/* Bloco do diretório pai de path; o último componente vai para name */
+static int find_parent(const char *path, char *name) {
+    char parent[DCACHE_PATH_MAX];
+    const char *last_slash = strrchr(path, '/');
+    size_t length = last_slash - path;
+
+    if (length >= sizeof(parent)) return -1;
+    memcpy(parent, path, length);
+    parent[length] = '\0';
+
+    strncpy(name, last_slash + 1, DIR_NAME_SIZE);
+    name[DIR_NAME_MAX] = '\0';
+    return find_directory_block(parent);
 }
 
-int count_entries(uint8_t *data_block) {
-    struct dir_entry_s entry;
-    int count = 0;
+/* Cópia da entrada apontada pela dentry, lida sob a trava do diretório pai */
+static void read_entry(const struct dentry_s *dentry, struct dir_entry_s *entry) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
 
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes != 0x00) {
-            count++;
+    dir_lock_read(dentry->parent_block);
+    memcpy(entry, view_block(dentry->entry_block, dir_data) + dentry->slot * DIR_ENTRY_SIZE,
+           sizeof(struct dir_entry_s));
+    dir_unlock(dentry->parent_block);
+}
+
+/*
+ * Só o tamanho muda: as demais entradas do bloco podem mudar em paralelo.
+ * Se os baldes do diretório foram refeitos, a entrada é procurada de novo.
+ */
+static void update_entry_size(const struct dentry_s *dentry, uint32_t size) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    struct dir_entry_s *entries = (struct dir_entry_s *)dir_data;
+    struct dir_pos_s pos = { dentry->entry_block, dentry->slot };
+
+    dir_lock_write(dentry->parent_block);
+    read_block(pos.block, dir_data);
+    if (entries[pos.slot].attributes != 0x01 || entries[pos.slot].first_block != dentry->block) {
+        if (dir_locate(dentry->parent_block, dentry->block, &pos) == -1) {
+            dir_unlock(dentry->parent_block);
+            journal_end();
+            return;
         }
+        read_block(pos.block, dir_data);
     }
-    return count;
+    entries[pos.slot].size = size;
+    journal_dir(pos.block, pos.slot, &entries[pos.slot]);
+    journal_end();
+    write_block(pos.block, dir_data);
+    dir_unlock(dentry->parent_block);
+}
+
+/*
+ * Resolve o arquivo e trava seu inode (o primeiro bloco). Entre a resolução
+ * e a trava o arquivo pode ter sido removido: a entrada é conferida e, se
+ * mudou, a dentry da cache é descartada e a resolução refeita.
+ */
+static int lock_file(const char *path, struct dentry_s *dentry, struct dir_entry_s *entry, int exclusive) {
+    char key[DCACHE_PATH_MAX];
+
+    dcache_normalize(path, key);
+    const char *name = strrchr(key, '/') + 1;
+
+    while (find_file(path, dentry) != -1) {
+        if (exclusive) inode_lock_write(dentry->block);
+        else inode_lock_read(dentry->block);
+
+        read_entry(dentry, entry);
+        if (entry->attributes == 0x01 && entry->first_block == dentry->block &&
+            strncmp((const char *)entry->filename, name, DIR_NAME_SIZE) == 0) {
+            return dentry->block;
+        }
+
+        inode_unlock(dentry->block);
+        dcache_remove(key);
+    }
+    return -1;
 }
 
 void ls(const char *path) {
-    struct dir_entry_s entry;
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    const struct dir_entry_s *entries;
+    uint32_t *blocks, count;
     int block;
 
+    ns_lock_read();
     block = find_directory_block(path);
     if (block != -1) {
-        read_block("filesystem.dat", block, data_block);
+        dir_lock_read(block);
+        count = dir_entry_blocks(block, &blocks);
         printf("Listando o diretório: %s\n", path);
-        for (int i = 0; i < DIR_ENTRIES; i++) {
-            memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-            if (entry.attributes != 0x00) {
-                printf("%s - %s\n", entry.filename, (entry.attributes == 0x01) ? "Arquivo" : "Diretório");
-                printf("Tamanho: %d bytes\n", entry.size);
-                printf("Bloco inicial: %d\n", entry.first_block);
-                printf("File attributes: %d\n", entry.attributes);
-                printf("Nome do arquivo: %s\n", entry.filename);
+        for (uint32_t b = 0; b < count; b++) {
+            entries = (const struct dir_entry_s *)view_block(blocks[b], dir_data);
+            for (uint32_t i = 0; i < DIR_ENTRIES; i++) {
+                const struct dir_entry_s *entry = &entries[i];
+                if (entry->attributes != 0x01 && entry->attributes != 0x02) continue;
+
+                printf("%s - %s\n", entry->filename, (entry->attributes == 0x01) ? "Arquivo" : "Diretório");
+                printf("Tamanho: %d bytes\n", entry->size);
+                printf("Bloco inicial: %d\n", entry->first_block);
+                printf("File attributes: %d\n", entry->attributes);
+                printf("Nome do arquivo: %s\n", entry->filename);
+                if (entry->attributes == 0x01) {
+                    printf("Fragmentos: %d\n", count_extents(entry->first_block));
+                }
             }
         }
+        free(blocks);
+        dir_unlock(block);
+        ns_unlock();
         return;
     }
 
@@ -219,359 +644,706 @@ void ls(const char *path) {
     if (block != -1) {
         printf("Informações do arquivo '%s':\n", path);
         printf("Bloco inicial: %d\n", block);
+        printf("Fragmentos: %d\n", count_extents(block));
+        ns_unlock();
         return;
     }
+    ns_unlock();
 
     printf("Erro: Caminho '%s' não encontrado.\n", path);
 }
 
-void mkdir(const char *path) {
-    struct dir_entry_s entry;
-    char dir_name[25];
-    int parent_block, dir_block;
-
-    char *last_slash = strrchr(path, '/');
-    if (last_slash == NULL) {
-        printf("Erro: Caminho inválido.\n");
-        return;
-    }
-
-    strncpy(dir_name, last_slash + 1, 25);
-    dir_name[24] = '\0';
-    *last_slash = '\0';
-    parent_block = find_directory_block(path);
-    *last_slash = '/';
+/* Cria um arquivo (0x01) ou diretório (0x02) vazio; devolve o bloco ou -1 */
+static int create_entry(const char *path, uint8_t attributes) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    struct dir_entry_s *entries = (struct dir_entry_s *)dir_data;
+    char name[DIR_NAME_SIZE];
+    struct dir_pos_s pos;
+    int parent_block, block;
 
+    if (!writable()) return -1;
+    parent_block = find_parent(path, name);
     if (parent_block == -1) {
         printf("Erro: Caminho '%s' não encontrado.\n", path);
-        return;
+        return -1;
     }
 
-    read_block("filesystem.dat", parent_block, data_block);
-    if (count_entries(data_block) >= 32) {
-        printf("Erro: O diretório está cheio. Não é possível criar mais entradas.\n");
-        return;
+    /* A verificação do nome e a inserção formam uma só operação no pai */
+    journal_begin();
+    dir_lock_write(parent_block);
+    if (dir_find(parent_block, name, &pos, NULL) != -1) {
+        dir_unlock(parent_block);
+        journal_end();
+        printf("Erro: Já existe um arquivo ou diretório com o nome '%s'.\n", name);
+        return -1;
     }
 
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes != 0x00 && strncmp((const char *)entry.filename, dir_name, 25) == 0) {
-            printf("Erro: Já existe um arquivo ou diretório com o nome '%s'.\n", dir_name);
-            return;
-        }
+    /* Pode acrescentar um bloco ao diretório ou refazer os baldes */
+    if (dir_reserve(parent_block, name, &pos) == -1) {
+        dir_unlock(parent_block);
+        journal_end();
+        return -1;
     }
 
-    dir_block = allocate_blocks(1);
-    if (dir_block == -1) return;
+    block = allocate_blocks(1);
+    if (block == -1) {
+        dir_unlock(parent_block);
+        journal_end();
+        return -1;
+    }
 
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes == 0x00) {
-            strncpy((char *)entry.filename, dir_name, 25);
-            entry.attributes = 0x02;
-            entry.first_block = dir_block;
-            entry.size = 0;
+    /* O bloco pode ter sido reaproveitado: não expor conteúdo antigo */
+    _Alignas(uint64_t) uint8_t empty[BLOCK_SIZE];
+    memset(empty, 0, BLOCK_SIZE);
+    write_block(block, empty);
+    if (attributes == 0x02) {
+        /* Um diretório com lixo no disco teria entradas falsas */
+        journal_zero(block);
+        dir_index_drop(block);
+    }
 
-            memcpy(&data_block[i * DIR_ENTRY_SIZE], &entry, sizeof(struct dir_entry_s));
-            write_block("filesystem.dat", parent_block, data_block);
-            printf("Diretório '%s' criado no caminho '%s'.\n", dir_name, path);
-            return;
-        }
+    read_block(pos.block, dir_data);
+    struct dir_entry_s *entry = &entries[pos.slot];
+    strncpy((char *)entry->filename, name, DIR_NAME_SIZE);
+    entry->attributes = attributes;
+    entry->first_block = block;
+    entry->size = 0;
+
+    /* O registro entra no diário antes de o diretório poder ir para o disco */
+    journal_dir(pos.block, pos.slot, entry);
+    journal_end();
+    write_block(pos.block, dir_data);
+    dir_index_insert(pos.block, entries, pos.slot);
+
+    struct dentry_s dentry = { parent_block, pos.block, pos.slot, block, attributes };
+    char key[DCACHE_PATH_MAX];
+    dcache_normalize(path, key);
+    dcache_insert(key, &dentry);
+    dir_unlock(parent_block);
+
+    commit_fat();
+    return block;
+}
+
+void mkdir(const char *path) {
+    if (strrchr(path, '/') == NULL) {
+        printf("Erro: Caminho inválido.\n");
+        return;
     }
 
-    printf("Erro: Diretório está cheio.\n");
+    ns_lock_read();
+    int block = create_entry(path, 0x02);
+    ns_unlock();
+
+    if (block != -1) {
+        if (!quiet) printf("Diretório '%.22s' criado no caminho '%s'.\n", strrchr(path, '/') + 1, path);
+    }
 }
 
 void create(const char *path) {
-    struct dir_entry_s entry;
-    char file_name[25];
-    int parent_block, file_block;
-
-    char *last_slash = strrchr(path, '/');
-    if (last_slash == NULL) {
+    if (strrchr(path, '/') == NULL) {
         printf("Erro: Caminho inválido.\n");
         return;
     }
 
-    strncpy(file_name, last_slash + 1, 25);
-    file_name[24] = '\0';
-    *last_slash = '\0';
-    parent_block = find_directory_block(path);
-    *last_slash = '/';
+    ns_lock_read();
+    int block = create_entry(path, 0x01);
+    ns_unlock();
 
+    if (block != -1) {
+        if (!quiet) printf("Arquivo '%.22s' criado no caminho '%s'.\n", strrchr(path, '/') + 1, path);
+    }
+}
+
+/* Libera a cadeia a partir de block, travando um grupo de cada vez */
+void free_chain(uint32_t block) {
+    while (block != FAT_EOF) {
+        uint32_t group_block = block;
+
+        alloc_group_lock(group_block);
+        while (block != FAT_EOF && block / ALLOC_GROUP_BLOCKS == group_block / ALLOC_GROUP_BLOCKS) {
+            uint32_t next_block = fat[block];
+            set_fat(block, FAT_FREE);
+            block = next_block;
+        }
+        alloc_group_unlock(group_block);
+    }
+}
+
+/*
+ * Remove a entrada de path. Devolve 1 sem alterar nada se ela for um
+ * diretório e o namespace não estiver travado em modo exclusivo.
+ */
+static int remove_entry(const char *path, int exclusive) {
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+    struct dir_entry_s *entries = (struct dir_entry_s *)dir_data;
+    struct dir_entry_s entry;
+    struct dir_pos_s pos;
+    char name[DIR_NAME_SIZE];
+    int parent_block, found;
+
+    if (!writable()) return -1;
+    parent_block = find_parent(path, name);
     if (parent_block == -1) {
         printf("Erro: Caminho '%s' não encontrado.\n", path);
-        return;
+        return -1;
     }
 
-    read_block("filesystem.dat", parent_block, data_block);
-    if (count_entries(data_block) >= 32) {
-        printf("Erro: O diretório está cheio. Não é possível criar mais entradas.\n");
-        return;
+    journal_begin();
+    while (1) {
+        dir_lock_read(parent_block);
+        found = dir_find(parent_block, name, &pos, &entry);
+        dir_unlock(parent_block);
+
+        if (found == -1) {
+            journal_end();
+            printf("Erro: Arquivo ou diretório '%s' não encontrado.\n", name);
+            return -1;
+        }
+        if (entry.attributes == 0x02 && !exclusive) {
+            journal_end();
+            return 1;
+        }
+
+        /* Espera quem ainda lê ou grava o arquivo; a trava do inode vem antes */
+        inode_lock_write(entry.first_block);
+        dir_lock_write(parent_block);
+        read_block(pos.block, dir_data);
+        if (entries[pos.slot].attributes == entry.attributes &&
+            entries[pos.slot].first_block == entry.first_block &&
+            strncmp((const char *)entries[pos.slot].filename, name, DIR_NAME_SIZE) == 0) {
+            break;
+        }
+        dir_unlock(parent_block);
+        inode_unlock(entry.first_block);
     }
 
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes != 0x00 && strncmp((const char *)entry.filename, file_name, 25) == 0) {
-            printf("Erro: Já existe um arquivo ou diretório com o nome '%s'.\n", file_name);
-            return;
+    if (entry.attributes == 0x02) {
+        if (!dir_is_empty(entry.first_block)) {
+            dir_unlock(parent_block);
+            inode_unlock(entry.first_block);
+            journal_end();
+            printf("Erro: Diretório '%s' não está vazio.\n", name);
+            return -1;
         }
+        dir_index_drop(entry.first_block);
     }
 
-    file_block = allocate_blocks(1);
-    if (file_block == -1) return;
+    free_chain(entry.first_block);
 
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes == 0x00) {
-            strncpy((char *)entry.filename, file_name, 25);
-            entry.attributes = 0x01;
-            entry.first_block = file_block;
-            entry.size = 0;
+    memset(&dir_data[pos.slot * DIR_ENTRY_SIZE], 0, DIR_ENTRY_SIZE);
+    journal_dir(pos.block, pos.slot, &entries[pos.slot]);
+    journal_end();
+    write_block(pos.block, dir_data);
+    dir_index_remove(pos.block, entries, pos.slot);
+    block_map_drop(entry.first_block);
+    ra_drop(entry.first_block);
 
-            memcpy(&data_block[i * DIR_ENTRY_SIZE], &entry, sizeof(struct dir_entry_s));
-            write_block("filesystem.dat", parent_block, data_block);
-            printf("Arquivo '%s' criado no caminho '%s'.\n", file_name, path);
-            return;
-        }
-    }
+    char key[DCACHE_PATH_MAX];
+    dcache_normalize(path, key);
+    dcache_remove(key);
+    dir_unlock(parent_block);
+    inode_unlock(entry.first_block);
 
-    printf("Erro: Diretório está cheio.\n");
+    commit_fat();
+    if (!quiet) printf("Arquivo ou diretório '%s' excluído.\n", name);
+    return 0;
 }
 
 void unlink(const char *path) {
-    struct dir_entry_s entry;
-    int parent_block, entry_index = -1;
-
-    char *last_slash = strrchr(path, '/');
-    if (last_slash == NULL) {
+    if (strrchr(path, '/') == NULL) {
         printf("Erro: Caminho inválido.\n");
         return;
     }
 
-    char name[25];
-    strncpy(name, last_slash + 1, 25);
-    name[24] = '\0';
-    *last_slash = '\0';
-    parent_block = find_directory_block(path);
-    *last_slash = '/';
+    ns_lock_read();
+    int status = remove_entry(path, 0);
+    ns_unlock();
 
-    if (parent_block == -1) {
-        printf("Erro: Caminho '%s' não encontrado.\n", path);
-        return;
-    }
-
-    read_block("filesystem.dat", parent_block, data_block);
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes != 0x00 && strncmp((const char *)entry.filename, name, 25) == 0) {
-            entry_index = i;
-            break;
-        }
+    if (status == 1) {
+        /* Só a remoção de diretórios exclui todas as outras operações */
+        ns_lock_write();
+        remove_entry(path, 1);
+        ns_unlock();
     }
+}
 
-    if (entry_index == -1) {
-        printf("Erro: Arquivo ou diretório '%s' não encontrado.\n", name);
+/* Origem dos dados gravados: um padrão repetido ou um arquivo do host */
+struct source_s {
+    const uint8_t *pattern;
+    uint32_t pattern_length;
+    uint64_t position;
+    FILE *file;
+};
+
+/*
+ * Preenche buf com os próximos length bytes da origem. O padrão é copiado
+ * uma vez a partir da fase atual e depois duplicado com memcpy: como o
+ * trecho já escrito é múltiplo do período, cada cópia continua o padrão.
+ */
+static void source_fill(struct source_s *src, uint8_t *buf, uint32_t length) {
+    if (src->file) {
+        size_t n = fread(buf, 1, length, src->file);
+        if (n < length) memset(buf + n, 0, length - n);
+        src->position += length;
         return;
     }
 
-    if (entry.attributes == 0x02) {
-        struct dir_entry_s check;
-        read_block("filesystem.dat", entry.first_block, data_block);
-        for (int i = 0; i < DIR_ENTRIES; i++) {
-            memcpy(&check, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-            if (check.attributes != 0x00) {
-                printf("Erro: Diretório '%s' não está vazio.\n", name);
-                return;
-            }
-        }
+    uint32_t phase = src->position % src->pattern_length;
+    uint32_t filled = src->pattern_length - phase;
+
+    if (filled > length) filled = length;
+    memcpy(buf, src->pattern + phase, filled);
+    if (filled < length) {
+        uint32_t head = length - filled < phase ? length - filled : phase;
+        memcpy(buf + filled, src->pattern, head);
+        filled += head;
     }
 
-    int current_block = entry.first_block;
-    while (current_block != 0x7fff) {
-        int next_block = fat[current_block];
-        fat[current_block] = 0x0000;
-        current_block = next_block;
+    while (filled < length) {
+        uint32_t chunk = filled < length - filled ? filled : length - filled;
+        memcpy(buf + filled, buf, chunk);
+        filled += chunk;
     }
+    src->position += length;
+}
 
-    memset(&data_block[entry_index * DIR_ENTRY_SIZE], 0, DIR_ENTRY_SIZE);
-    write_block("filesystem.dat", parent_block, data_block);
-    write_fat("filesystem.dat", fat);
+/*
+ * Grava length bytes da origem na cadeia que começa em block, a partir de
+ * offset. Os offset bytes iniciais do primeiro bloco vêm de head.
+ */
+static void write_region(uint32_t block, uint32_t offset, const uint8_t *head,
+                         uint32_t length, struct source_s *src) {
+    /* Dois lotes alternados: um é preenchido enquanto o outro é gravado */
+    uint32_t batch_blocks[2][CHAIN_BATCH];
+    uint8_t batch_data[2][CHAIN_BATCH_BYTES];
+    struct aio_batch_s batches[2] = { {0}, {0} };
+    uint32_t region_end = offset + length;
+    uint32_t position = 0;
+    int current = 0;
+
+    while (position < region_end) {
+        uint32_t *blocks = batch_blocks[current];
+        uint8_t *chain_data = batch_data[current];
+
+        aio_wait(&batches[current]);
+        uint32_t count = chain_blocks(block, blocks, CHAIN_BATCH);
+        if (count * BLOCK_SIZE > region_end - position) {
+            count = (uint32_t)(((uint64_t)region_end - position + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        block = fat[blocks[count - 1]];
 
-    printf("Arquivo ou diretório '%s' excluído.\n", name);
-}
+        uint32_t start = position == 0 ? offset : 0;
+        uint32_t end = region_end - position < count * BLOCK_SIZE ? region_end - position : count * BLOCK_SIZE;
 
-void write(const char *data, int rep, const char *path) {
-    struct dir_entry_s entry;
-    int file_block = find_file_block(path);
+        if (start > 0) memcpy(chain_data, head, start);
+        source_fill(src, chain_data + start, end - start);
+        memset(chain_data + end, 0, count * BLOCK_SIZE - end);
 
-    if (file_block == -1) {
-        printf("Erro: Arquivo '%s' não encontrado.\n", path);
-        return;
+        write_chain(blocks, count, chain_data, &batches[current]);
+        position += count * BLOCK_SIZE;
+        current ^= 1;
     }
 
-    int current_block = file_block;
-    while (current_block != 0x7fff) {
-        int next_block = fat[current_block];
-        fat[current_block] = 0x0000;
-        current_block = next_block;
+    aio_wait(&batches[0]);
+    aio_wait(&batches[1]);
+}
+
+/* Ajusta a cadeia para num_blocks blocos (ao menos um), mantendo o primeiro bloco */
+static int resize_chain(uint32_t first_block, uint32_t num_blocks) {
+    uint32_t count = block_map_length(first_block);
+    uint32_t tail_block;
+
+    if (count == 0 || num_blocks == 0) return -1;
+
+    if (num_blocks > count) {
+        block_map_blocks(first_block, count - 1, &tail_block, 1);
+        if (allocate_extent(num_blocks - count, tail_block) == -1) return -1;
+        block_map_extend(first_block);
+    } else if (num_blocks < count) {
+        block_map_blocks(first_block, num_blocks - 1, &tail_block, 1);
+        uint32_t next_block = fat[tail_block];
+        link_block(tail_block, FAT_EOF);
+        free_chain(next_block);
+        block_map_truncate(first_block, num_blocks);
+        ra_drop(first_block);
     }
 
-    int data_length = strlen(data) * rep;
-    int bytes_written = 0;
+    return 0;
+}
 
-    current_block = allocate_blocks(1);
-    if (current_block == -1) {
-        printf("Erro: Não foi possível alocar blocos para o arquivo '%s'.\n", path);
-        return;
+/*
+ * Troca por blocos novos os blocos da cadeia de índice from até to (o
+ * primeiro é 1: a cabeça nunca é compartilhada) que algum snapshot ainda
+ * usa. O conteúdo não é copiado: quem chama regrava os blocos inteiros.
+ */
+static int unshare_chain(uint32_t first_block, uint32_t from, uint32_t to) {
+    uint32_t prev, block, shared = 0;
+    int fresh;
+
+    if (snapshot_count() == 0) return 0;
+
+    block_map_blocks(first_block, from - 1, &prev, 1);
+    block = fat[prev];
+    for (uint32_t i = from; i <= to && block < BLOCKS; i++, block = fat[block]) {
+        shared += snapshot_shared(block);
     }
+    if (shared == 0) return 0;
+
+    fresh = allocate_extent(shared, -1);
+    if (fresh == -1) return -1;
 
-    int first_block = current_block;
+    block = fat[prev];
+    for (uint32_t i = from; i <= to && block < BLOCKS; i++) {
+        uint32_t next = fat[block];
 
-    while (bytes_written < data_length) {
-        memset(data_block, 0, BLOCK_SIZE);
+        if (snapshot_shared(block)) {
+            uint32_t copy = fresh;
 
-        int bytes_to_copy = (data_length - bytes_written > BLOCK_SIZE) ? BLOCK_SIZE : (data_length - bytes_written);
-        for (int i = 0; i < bytes_to_copy; i++) {
-            data_block[i] = data[(bytes_written + i) % strlen(data)];
+            fresh = fat[copy];
+            link_block(copy, next);
+            link_block(prev, copy);
+            /* Continua ocupado na FAT do snapshot, fora do mapa de livres */
+            link_block(block, FAT_FREE);
+            block = copy;
         }
+        prev = block;
+        block = next;
+    }
 
-        write_block("filesystem.dat", current_block, data_block);
-        bytes_written += bytes_to_copy;
+    block_map_drop(first_block);
+    ra_drop(first_block);
+    return 0;
+}
 
-        if (bytes_written < data_length) {
+/* Corpo de write_stream; o inode do arquivo já está travado para escrita */
+static int write_locked(const char *path, const struct dentry_s *dentry, const struct dir_entry_s *entry,
+                        struct source_s *src, uint32_t length, int appending) {
+    _Alignas(uint64_t) uint8_t tail[BLOCK_SIZE];
+    uint32_t file_block = dentry->block;
+    uint32_t offset = 0;
+    int start_block;
+
+    if (!appending) {
+        /* Reaproveita a cadeia atual, só crescendo ou encurtando a cauda */
+        uint32_t num_blocks = length > 0 ? (uint32_t)(((uint64_t)length + BLOCK_SIZE - 1) / BLOCK_SIZE) : 1;
+        if (resize_chain(file_block, num_blocks) == -1 ||
+            (num_blocks > 1 && unshare_chain(file_block, 1, num_blocks - 1) == -1)) {
+            printf("Erro: Não foi possível alocar blocos para o arquivo '%s'.\n", path);
+            return -1;
+        }
+        start_block = file_block;
+    } else {
+        /* O tamanho da entrada diz onde termina o último bloco */
+        uint32_t count = block_map_length(file_block);
+        uint32_t tail_block;
+        if (count == 0) return -1;
+        if ((uint64_t)entry->size + length > UINT32_MAX) {
+            printf("Erro: O arquivo '%s' excederia o tamanho máximo.\n", path);
+            return -1;
+        }
 
-            int next_block = allocate_blocks(1);
-            if (next_block == -1) {
+        block_map_blocks(file_block, count - 1, &tail_block, 1);
+        uint32_t tail_start = (count - 1) * BLOCK_SIZE;
+        offset = entry->size > tail_start ? entry->size - tail_start : 0;
+        if (offset > BLOCK_SIZE) offset = BLOCK_SIZE;
+
+        /* O último bloco será regravado: lido antes de uma possível troca */
+        if (offset > 0 && offset < BLOCK_SIZE) read_block(tail_block, tail);
+        if (offset < BLOCK_SIZE && count > 1) {
+            if (unshare_chain(file_block, count - 1, count - 1) == -1) {
                 printf("Erro: Não foi possível alocar mais blocos para o arquivo '%s'.\n", path);
-                return;
+                return -1;
             }
-            fat[current_block] = next_block;
-            current_block = next_block;
-        } else {
-            fat[current_block] = 0x7fff;
+            block_map_blocks(file_block, count - 1, &tail_block, 1);
         }
-    }
 
-    int parent_block = find_directory_block(path);
-    read_block("filesystem.dat", parent_block, data_block);
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (strcmp((const char *)entry.filename, path + 1) == 0) {
-            entry.size = data_length;
-            entry.first_block = first_block;
-            memcpy(&data_block[i * DIR_ENTRY_SIZE], &entry, sizeof(struct dir_entry_s));
-            write_block("filesystem.dat", parent_block, data_block);
-            break;
+        int extra_blocks = (int)(((uint64_t)offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE - 1);
+        if (extra_blocks > 0) {
+            if (allocate_extent(extra_blocks, tail_block) == -1) {
+                printf("Erro: Não foi possível alocar mais blocos para o arquivo '%s'.\n", path);
+                return -1;
+            }
+            block_map_extend(file_block);
+        }
+
+        if (offset == BLOCK_SIZE) {
+            /* Último bloco cheio: os dados começam no primeiro bloco novo */
+            start_block = fat[tail_block];
+            offset = 0;
+        } else {
+            start_block = tail_block;
         }
     }
 
-    write_fat("filesystem.dat", fat);
+    if (length > 0) {
+        write_region(start_block, offset, tail, length, src);
+    }
 
-    printf("Dados sobrescritos no arquivo '%s'.\n", path);
+    /* A dentry já aponta para a entrada: sem nova busca no diretório pai */
+    update_entry_size(dentry, appending ? entry->size + length : length);
+    return 0;
 }
 
-void append(const char *data, int rep, const char *path) {
+/* Sobrescreve (appending = 0) ou estende o arquivo com length bytes da origem */
+static int write_stream(const char *path, struct source_s *src, uint32_t length, int appending) {
     struct dir_entry_s entry;
-    int file_block = find_file_block(path);
+    struct dentry_s dentry;
+    int status;
 
+    if (!writable()) return -1;
+    ns_lock_read();
+    journal_begin();
+    int file_block = lock_file(path, &dentry, &entry, 1);
     if (file_block == -1) {
+        journal_end();
+        ns_unlock();
         printf("Erro: Arquivo '%s' não encontrado.\n", path);
-        return;
+        return -1;
     }
 
-    int data_length = strlen(data) * rep;
+    status = write_locked(path, &dentry, &entry, src, length, appending);
+    /* Em caso de erro o registro ainda está aberto */
+    journal_end();
+    inode_unlock(file_block);
+    ns_unlock();
+
+    commit_fat();
+    return status;
+}
+
+/* Grava rep cópias de um buffer qualquer (pode conter bytes nulos) */
+int write_buffer(const uint8_t *data, uint32_t length, uint32_t rep, const char *path, int appending) {
+    struct source_s src = { data, length, 0, NULL };
+    uint64_t total = (uint64_t)length * rep;
 
-    int current_block = file_block;
-    while (fat[current_block] != 0x7fff) {
-        current_block = fat[current_block];
+    /* Além disso nem o tamanho da entrada nem a cadeia dariam conta */
+    if (total > UINT32_MAX) {
+        printf("Erro: %llu bytes excedem o tamanho máximo de um arquivo.\n", (unsigned long long)total);
+        return -1;
     }
+    return write_stream(path, &src, (uint32_t)total, appending);
+}
 
-    read_block("filesystem.dat", current_block, data_block);
-    int offset = strlen((char *)data_block);
+void write(const char *data, int rep, const char *path) {
+    if (rep < 0) {
+        printf("Erro: Número de repetições inválido: %d.\n", rep);
+        return;
+    }
+    if (write_buffer((const uint8_t *)data, strlen(data), rep, path, 0) == 0) {
+        if (!quiet) printf("Dados sobrescritos no arquivo '%s'.\n", path);
+    }
+}
 
-    int bytes_written = 0;
-    while (bytes_written < data_length) {
-        int bytes_to_copy = (data_length - bytes_written > BLOCK_SIZE - offset) 
-                            ? (BLOCK_SIZE - offset) 
-                            : (data_length - bytes_written);
-        for (int i = 0; i < bytes_to_copy; i++) {
-            data_block[offset + i] = data[(bytes_written + i) % strlen(data)];
-        }
-        bytes_written += bytes_to_copy;
-        offset += bytes_to_copy;
+void append(const char *data, int rep, const char *path) {
+    if (rep < 0) {
+        printf("Erro: Número de repetições inválido: %d.\n", rep);
+        return;
+    }
+    if (write_buffer((const uint8_t *)data, strlen(data), rep, path, 1) == 0) {
+        if (!quiet) printf("Dados anexados no arquivo '%s'.\n", path);
+    }
+}
 
-        if (offset == BLOCK_SIZE) {
-            write_block("filesystem.dat", current_block, data_block);
+/* Encurta o arquivo liberando a cauda da cadeia, ou o estende com zeros */
+void truncate(const char *path, uint32_t size) {
+    struct dir_entry_s entry;
+    struct dentry_s dentry;
+    int status = 0;
 
-            int next_block = allocate_blocks(1);
-            if (next_block == -1) {
-                printf("Erro: Não foi possível alocar mais blocos para o arquivo '%s'.\n", path);
-                return;
-            }
+    if (!writable()) return;
+    ns_lock_read();
+    journal_begin();
+    int file_block = lock_file(path, &dentry, &entry, 1);
+    if (file_block == -1) {
+        journal_end();
+        ns_unlock();
+        printf("Erro: Arquivo '%s' não encontrado.\n", path);
+        return;
+    }
 
-            fat[current_block] = next_block;
-            current_block = next_block;
-            offset = 0;
-            memset(data_block, 0, BLOCK_SIZE);
-        }
+    if (size > entry.size) {
+        static const uint8_t zero = 0;
+        struct source_s src = { &zero, 1, 0, NULL };
+        status = write_locked(path, &dentry, &entry, &src, size - entry.size, 1);
+    } else {
+        uint32_t num_blocks = size > 0 ? (uint32_t)(((uint64_t)size + BLOCK_SIZE - 1) / BLOCK_SIZE) : 1;
+        status = resize_chain(file_block, num_blocks);
+        if (status == 0) update_entry_size(&dentry, size);
     }
+    journal_end();
+    inode_unlock(file_block);
+    ns_unlock();
 
-    write_block("filesystem.dat", current_block, data_block);
-    fat[current_block] = 0x7fff;
+    commit_fat();
+    if (status == 0 && !quiet) printf("Arquivo '%s' ajustado para %u bytes.\n", path, size);
+}
 
-    int parent_block = find_directory_block(path);
-    read_block("filesystem.dat", parent_block, data_block);
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &data_block[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (strcmp((const char *)entry.filename, path + 1) == 0) {
-            entry.size += data_length;
-            memcpy(&data_block[i * DIR_ENTRY_SIZE], &entry, sizeof(struct dir_entry_s));
-            write_block("filesystem.dat", parent_block, data_block);
-            break;
-        }
+/* Copia um arquivo do host (ou length bytes da entrada padrão, com "-") */
+void import_file(const char *host_file, const char *path, uint32_t length) {
+    struct source_s src = { NULL, 0, 0, NULL };
+    int from_stdin = strcmp(host_file, "-") == 0;
+
+    src.file = from_stdin ? stdin : fopen(host_file, "rb");
+    if (!src.file) {
+        printf("Erro: Não foi possível abrir o arquivo '%s'.\n", host_file);
+        return;
+    }
+
+    if (!from_stdin) {
+        fseek(src.file, 0, SEEK_END);
+        length = ftell(src.file);
+        fseek(src.file, 0, SEEK_SET);
+    }
+
+    if (write_stream(path, &src, length, 0) == 0) {
+        if (!quiet) printf("Arquivo '%s' importado para '%s' (%u bytes).\n", host_file, path, length);
     }
 
-    write_fat("filesystem.dat", fat);
+    if (!from_stdin) fclose(src.file);
+}
+
+/* Pede os blocos lógicos k..last (no máximo um lote); devolve quantos */
+static uint32_t submit_range(uint32_t file_block, uint32_t k, uint32_t last, uint32_t *blocks,
+                             uint8_t *buf, struct aio_batch_s *batch, int mapped) {
+    uint32_t n = last - k + 1 < CHAIN_BATCH ? last - k + 1 : CHAIN_BATCH;
 
-    printf("Dados anexados no arquivo '%s'.\n", path);
+    n = block_map_blocks(file_block, k, blocks, n);
+    if (!mapped) read_chain_submit(blocks, n, buf, batch);
+    return n;
 }
 
-void read(const char *path) {
-    int file_block = find_file_block(path);
+/* Lê length bytes a partir de offset, tocando só os blocos necessários */
+void read(const char *path, uint32_t offset, uint32_t length) {
+    struct dir_entry_s entry;
+    struct dentry_s dentry;
 
+    ns_lock_read();
+    int file_block = lock_file(path, &dentry, &entry, 0);
     if (file_block == -1) {
+        ns_unlock();
         printf("Erro: Arquivo '%s' não encontrado.\n", path);
         return;
     }
 
+    uint32_t size = entry.size;
+    if (offset > size) offset = size;
+    if (length > size - offset) length = size - offset;
+
+    /* Leituras concorrentes não intercalam a saída */
+    flockfile(stdout);
     printf("Conteúdo de '%s':\n", path);
 
-    int current_block = file_block;
-    while (current_block != 0x7fff) {
-        read_block("filesystem.dat", current_block, data_block);
-        printf("%s", data_block);
+    uint32_t count = block_map_length(file_block);
+    if (length > 0 && count > 0) {
+        uint8_t chain_data[2][CHAIN_BATCH_BYTES];
+        uint32_t blocks[2][CHAIN_BATCH], n[2];
+        struct aio_batch_s batches[2] = { {0}, {0} };
+        uint32_t end = offset + length;
+        uint32_t last = (end - 1) / BLOCK_SIZE;
+        uint32_t k = offset / BLOCK_SIZE;
+        int current = 0;
+
+        /* Com mmap os blocos são lidos direto do mapeamento */
+        int mapped = dev_block_ptr(ROOT_BLOCK) != NULL;
+
+        if (last >= count) last = count - 1;
 
-        current_block = fat[current_block];
+        n[0] = submit_range(file_block, k, last, blocks[0], chain_data[0], &batches[0], mapped);
+
+        /* Leitura sequencial entre comandos: os blocos após o fim já vão para a cache */
+        if (!mapped) {
+            uint32_t ahead_blocks[RA_MAX_BLOCKS], from;
+            uint32_t ahead = ra_next(file_block, k, last + 1, count, &from);
+
+            ahead = block_map_blocks(file_block, from, ahead_blocks, ahead);
+            cache_prefetch(ahead_blocks, ahead);
+        }
+        for (; k <= last; k += CHAIN_BATCH) {
+            int next = current ^ 1;
+
+            /* Leitura antecipada: o próximo lote já vai para o disco */
+            if (k + CHAIN_BATCH <= last) {
+                n[next] = submit_range(file_block, k + CHAIN_BATCH, last, blocks[next], chain_data[next],
+                                       &batches[next], mapped);
+            }
+            if (!mapped) read_chain_wait(blocks[current], n[current], chain_data[current], &batches[current]);
+
+            for (uint32_t i = 0; i < n[current]; i++) {
+                const uint8_t *block = mapped ? dev_block_ptr(blocks[current][i]) : &chain_data[current][i * BLOCK_SIZE];
+                uint32_t block_start = (k + i) * BLOCK_SIZE;
+                uint32_t from = offset > block_start ? offset - block_start : 0;
+                uint32_t to = end - block_start < BLOCK_SIZE ? end - block_start : BLOCK_SIZE;
+                fwrite(block + from, 1, to - from, stdout);
+            }
+            current = next;
+        }
     }
     printf("\n");
+    funlockfile(stdout);
+
+    inode_unlock(file_block);
+    ns_unlock();
 }
 
-void map_directory(uint32_t block) {
-    struct dir_entry_s entry;
-    uint8_t dir_data[BLOCK_SIZE];
+/*
+ * Percorre a árvore mantendo os próximos window subdiretórios irmãos já
+ * pedidos à cache. A janela cresce cada vez que um diretório chega pela
+ * leitura antecipada antes de ser visitado.
+ */
+static void walk_directory(uint32_t block, uint32_t *window) {
+    _Alignas(uint64_t) uint8_t first[BLOCK_SIZE];
+    struct dir_entry_s *entries;
+    uint32_t *blocks, *children;
+    uint32_t total, count = 0, visited = 0, issued = 0;
+
+    /* Copia as entradas e solta a trava antes de descer nos subdiretórios */
+    dir_lock_read(block);
+    if (!dev_block_ptr(block) && cache_read(block, first)) {
+        *window = ra_grow(*window);
+    }
+    total = dir_entry_blocks(block, &blocks) * DIR_ENTRIES;
+    /* Na heap: a recursão com diretórios grandes esgotaria a pilha */
+    entries = malloc((size_t)total * DIR_ENTRY_SIZE + 1);
+    children = malloc((size_t)total * sizeof(uint32_t) + 1);
+    if (entries && children) read_chain(blocks, total / DIR_ENTRIES, (uint8_t *)entries);
+    dir_unlock(block);
+    free(blocks);
+
+    if (!entries || !children) {
+        free(entries);
+        free(children);
+        return;
+    }
 
-    read_block("filesystem.dat", block, dir_data);
-    for (int i = 0; i < DIR_ENTRIES; i++) {
-        memcpy(&entry, &dir_data[i * DIR_ENTRY_SIZE], sizeof(struct dir_entry_s));
-        if (entry.attributes != 0x00) {
-            strcpy(block_names[entry.first_block], (char *)entry.filename);
+    for (uint32_t i = 0; i < total; i++) {
+        if (entries[i].attributes == 0x02) children[count++] = entries[i].first_block;
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        if (entries[i].attributes == 0x01 || entries[i].attributes == 0x02) {
+            strcpy(block_names[entries[i].first_block], (char *)entries[i].filename);
 
-            if (entry.attributes == 0x02) {
-                map_directory(entry.first_block);
+            if (entries[i].attributes == 0x02) {
+                uint32_t want = visited + *window < count ? visited + *window : count;
+                if (want > issued) {
+                    cache_prefetch(&children[issued], want - issued);
+                    issued = want;
+                }
+                visited++;
+                walk_directory(entries[i].first_block, window);
             }
         }
     }
+
+    free(entries);
+    free(children);
+}
+
+void map_directory(uint32_t block) {
+    uint32_t window = RA_MIN_BLOCKS;
+
+    walk_directory(block, &window);
 }
 
 void export_fat_to_file(const char *filename) {
@@ -583,91 +1355,504 @@ void export_fat_to_file(const char *filename) {
 
     fprintf(f, "=== Tabela de Alocação de Arquivos (FAT) ===\n");
 
-    for (int i = 0; i < BLOCKS; i++) {
+    /* block_names é global: uma exportação por vez */
+    pthread_mutex_lock(&export_mutex);
+    ns_lock_read();
+    for (uint32_t i = 0; i < BLOCKS; i++) {
         strcpy(block_names[i], "");
     }
 
-    map_directory(ROOT_BLOCK);
+    map_directory(root_dir);
+
+    for (uint32_t i = 0; i < BLOCKS; i++) {
+        /* Outras threads continuam alocando: lê a entrada com o grupo travado */
+        alloc_group_lock(i);
+        uint32_t entry = fat[i];
+        alloc_group_unlock(i);
 
-    for (int i = 0; i < BLOCKS; i++) {
-        if (i < FAT_BLOCKS) {
-            fprintf(f, "Bloco %d: Reservado para FAT [Código: 0x7ffe]\n", i);
+        if (i == 0) {
+            fprintf(f, "Bloco %u: Superbloco [Código: 0x%08x]\n", i, FAT_RESERVED);
+        } else if (i < ROOT_BLOCK) {
+            fprintf(f, "Bloco %u: Reservado para FAT [Código: 0x%08x]\n", i, FAT_RESERVED);
         } else if (i == ROOT_BLOCK) {
-            fprintf(f, "Bloco %d: Diretório raiz [Código: 0x7fff]\n", i);
-        } else if (fat[i] == 0x0000) {
-            fprintf(f, "Bloco %d: Livre [Código: 0x0000]\n", i);
-        } else if (fat[i] == 0x7fff) {
+            fprintf(f, "Bloco %u: Diretório raiz [Código: 0x%08x]\n", i, FAT_EOF);
+        } else if (entry == FAT_FREE) {
+            fprintf(f, "Bloco %u: Livre [Código: 0x%08x]\n", i, FAT_FREE);
+        } else if (entry == FAT_EOF) {
             if (strlen(block_names[i]) > 0) {
-                fprintf(f, "Bloco %d: Fim de arquivo (%s) [Código: 0x7fff]\n", i, block_names[i]);
+                fprintf(f, "Bloco %u: Fim de arquivo (%s) [Código: 0x%08x]\n", i, block_names[i], FAT_EOF);
             } else {
-                fprintf(f, "Bloco %d: Fim de arquivo ou diretório [Código: 0x7fff]\n", i);
+                fprintf(f, "Bloco %u: Fim de arquivo ou diretório [Código: 0x%08x]\n", i, FAT_EOF);
             }
-        } else if (fat[i] >= 0x0001 && fat[i] <= 0x7ffd) {
+        } else if (entry < BLOCKS) {
             if (strlen(block_names[i]) > 0) {
-                fprintf(f, "Bloco %d: Alocado para (%s) - Próximo bloco %d [Código: 0x%04x]\n", i, block_names[i], fat[i], fat[i]);
+                fprintf(f, "Bloco %u: Alocado para (%s) - Próximo bloco %u [Código: 0x%08x]\n", i, block_names[i], entry, entry);
             } else {
-                fprintf(f, "Bloco %d: Alocado - Próximo bloco %d [Código: 0x%04x]\n", i, fat[i], fat[i]);
+                fprintf(f, "Bloco %u: Alocado - Próximo bloco %u [Código: 0x%08x]\n", i, entry, entry);
             }
         } else {
-            fprintf(f, "Bloco %d: Estado desconhecido [Código: 0x%04x]\n", i, fat[i]);
+            fprintf(f, "Bloco %u: Estado desconhecido [Código: 0x%08x]\n", i, entry);
         }
     }
+    ns_unlock();
+    pthread_mutex_unlock(&export_mutex);
 
     fclose(f);
-    printf("Tabela FAT e informações exportadas para o arquivo '%s'.\n", filename);
+    if (!quiet) printf("Tabela FAT e informações exportadas para o arquivo '%s'.\n", filename);
 }
 
-int main() {
-    char command[256];
+struct extent_out_s {
+    FILE *f;
+    int json;
+    uint32_t count;
+};
 
-    while (1) {
-        printf("filesystem> ");
-        fgets(command, 256, stdin);
-
-        if (strncmp(command, "init", 4) == 0) {
-            init_filesystem();
-        } else if (strncmp(command, "load", 4) == 0) {
-            load_filesystem();
-        } else if (strncmp(command, "ls", 2) == 0) {
-            char path[256];
-            sscanf(command + 3, "%s", path);
-            ls(path);
-        } else if (strncmp(command, "mkdir", 5) == 0) {
-            char path[256];
-            sscanf(command + 6, "%s", path);
-            mkdir(path);
-        } else if (strncmp(command, "create", 6) == 0) {
-            char path[256];
-            sscanf(command + 7, "%s", path);
-            create(path);
-        } else if (strncmp(command, "unlink", 6) == 0) {
-            char path[256];
-            sscanf(command + 7, "%s", path);
-            unlink(path);
-        } else if (strncmp(command, "write", 5) == 0) {
-            char data[1024], path[256];
-            int rep;
-            sscanf(command + 6, "\"%[^\"]\" %d %s", data, &rep, path);
+static void put_extent(struct extent_out_s *out, uint32_t start, uint32_t end) {
+    const char *sep = out->count++ == 0 ? "" : out->json ? "," : ", ";
+
+    if (out->json) fprintf(out->f, "%s[%u,%u]", sep, start, end);
+    else if (start == end) fprintf(out->f, "%s%u", sep, start);
+    else fprintf(out->f, "%s%u-%u", sep, start, end);
+}
+
+static void put_name(FILE *f, const char *name, int json) {
+    if (!json) {
+        fprintf(f, "%s: ", name[0] ? name : "(sem nome)");
+        return;
+    }
+    fputs("{\"name\":\"", f);
+    for (const char *c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') fprintf(f, "\\%c", *c);
+        else if ((uint8_t)*c < 0x20) fprintf(f, "\\u%04x", (uint8_t)*c);
+        else fputc(*c, f);
+    }
+    fputs("\",\"extents\":[", f);
+}
+
+/* Faixas [first, BLOCKS) cujos blocos satisfazem match, como extensões */
+static void put_ranges(struct extent_out_s *out, const uint32_t *copy, const uint32_t *owner,
+                       int (*match)(uint32_t entry, uint32_t owner)) {
+    uint32_t start = 0;
+    int open = 0;
+
+    out->count = 0;
+    for (uint32_t i = 0; i <= BLOCKS; i++) {
+        int hit = i < BLOCKS && match(copy[i], owner[i]);
+        if (hit && !open) start = i;
+        if (!hit && open) put_extent(out, start, i - 1);
+        open = hit;
+    }
+}
+
+static int is_reserved(uint32_t entry, uint32_t owner) { (void)owner; return entry == FAT_RESERVED; }
+static int is_free(uint32_t entry, uint32_t owner) { (void)owner; return entry == FAT_FREE; }
+/* Ocupado mas fora de qualquer cadeia com início (ciclos, valores inválidos) */
+static int is_unowned(uint32_t entry, uint32_t owner) {
+    return entry != FAT_FREE && entry != FAT_RESERVED && owner == FAT_FREE;
+}
+
+/*
+ * Exportação compacta: cada cadeia vira uma linha de extensões
+ * ("arquivo: 100-163, 200-231"), ou um objeto com json. Trabalha sobre uma
+ * cópia da FAT: uma passada marca os blocos apontados por alguém, os que
+ * sobram são inícios de cadeia, e o vetor owner guarda o início de cada
+ * bloco (FAT_FREE: nenhum). Só os nomes dos inícios são limpos antes de mapear os diretórios.
+ */
+void export_fat_compact(const char *filename, int json) {
+    FILE *f = fopen(filename, "w");
+    uint32_t *copy = malloc((size_t)BLOCKS * sizeof(uint32_t));
+    uint32_t *owner = malloc((size_t)BLOCKS * sizeof(uint32_t));
+    uint64_t *pointed = calloc((BLOCKS + 63) / 64, sizeof(uint64_t));
+    struct extent_out_s out = {f, json, 0};
+    uint32_t chains = 0;
+
+    if (!f || !copy || !owner || !pointed) {
+        if (!f) {
+            printf("Erro: Não foi possível abrir o arquivo '%s' para escrita.\n", filename);
+        } else {
+            printf("Erro: Memória insuficiente para exportar %u blocos.\n", BLOCKS);
+            fclose(f);
+        }
+        free(copy);
+        free(owner);
+        free(pointed);
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    pthread_mutex_lock(&export_mutex);
+    ns_lock_read();
+    for (uint32_t g = 0; g < BLOCKS; g += ALLOC_GROUP_BLOCKS) {
+        uint32_t n = BLOCKS - g < ALLOC_GROUP_BLOCKS ? BLOCKS - g : ALLOC_GROUP_BLOCKS;
+        alloc_group_lock(g);
+        memcpy(copy + g, fat + g, n * sizeof(uint32_t));
+        alloc_group_unlock(g);
+    }
+
+    memset(owner, 0, (size_t)BLOCKS * sizeof(uint32_t));
+    for (uint32_t i = ROOT_BLOCK; i < BLOCKS; i++) {
+        if (copy[i] > ROOT_BLOCK && copy[i] < BLOCKS) pointed[copy[i] / 64] |= (uint64_t)1 << (copy[i] % 64);
+    }
+    for (uint32_t i = ROOT_BLOCK; i < BLOCKS; i++) {
+        if (copy[i] != FAT_FREE && !((pointed[i / 64] >> (i % 64)) & 1)) block_names[i][0] = '\0';
+    }
+    map_directory(root_dir);
+    strcpy(block_names[root_dir], "/");
+
+    if (json) fprintf(f, "{\"block_size\":%u,\"blocks\":%u,\"chains\":[", BLOCK_SIZE, BLOCKS);
+    else fprintf(f, "=== FAT em extensões (%u blocos de %u bytes) ===\n", BLOCKS, BLOCK_SIZE);
+
+    for (uint32_t head = ROOT_BLOCK; head < BLOCKS; head++) {
+        if (copy[head] == FAT_FREE || copy[head] == FAT_RESERVED) continue;
+        if ((pointed[head / 64] >> (head % 64)) & 1) continue;
+
+        if (json && chains > 0) fputc(',', f);
+        put_name(f, block_names[head], json);
+        chains++;
+        out.count = 0;
+
+        /* owner também corta ciclos: um bloco já visto encerra a cadeia */
+        uint32_t start = head, block = head;
+        while (1) {
+            owner[block] = head;
+            uint32_t next = copy[block];
+            if (next <= ROOT_BLOCK || next >= BLOCKS || owner[next] != FAT_FREE) break;
+            if (next != block + 1) {
+                put_extent(&out, start, block);
+                start = next;
+            }
+            block = next;
+        }
+        put_extent(&out, start, block);
+        fputs(json ? "]}" : "\n", f);
+    }
+
+    if (json) fputs("],\"reserved\":[", f);
+    else fputs("reservado: ", f);
+    put_ranges(&out, copy, owner, is_reserved);
+    fputs(json ? "],\"free\":[" : "\nlivre: ", f);
+    put_ranges(&out, copy, owner, is_free);
+    fputs(json ? "],\"unowned\":[" : "\nsem dono: ", f);
+    put_ranges(&out, copy, owner, is_unowned);
+    fputs(json ? "]}\n" : "\n", f);
+
+    ns_unlock();
+    pthread_mutex_unlock(&export_mutex);
+
+    fclose(f);
+    free(copy);
+    free(owner);
+    free(pointed);
+    if (!quiet) printf("%u cadeias exportadas para o arquivo '%s'.\n", chains, filename);
+}
+
+#ifndef FILESYSTEM_NO_MAIN
+/*
+ * Modo avulso: "filesystem fsck <imagem> [repair]". Sai com 0 se a imagem
+ * está íntegra, 1 se os problemas foram corrigidos e 4 se ficaram.
+ */
+static int fsck_image(const char *image, int repair) {
+    struct fsck_report_s report;
+
+    load_filesystem(image, 0, NULL);
+    if (!dev_is_open()) return 8;
+
+    uint32_t problems = fsck_run(repair, &report);
+    fsck_print(&report, repair);
+    flush_filesystem();
+    aio_drain();
+    dev_close();
+
+    if (problems == 0) return 0;
+    return repair ? 1 : 4;
+}
+
+static int dispatch(char *command) {
+    if (strncmp(command, "init", 4) == 0) {
+        /* init [imagem] [mmap] [bs=N] [blocks=N] */
+        char image[256] = DEFAULT_IMAGE, token[256];
+        uint32_t block_size = DEFAULT_BLOCK_SIZE, blocks = DEFAULT_BLOCKS;
+        int mapped = 0, used;
+        const char *p = command + 4;
+
+        while (sscanf(p, "%255s%n", token, &used) == 1) {
+            p += used;
+            if (strcmp(token, "mmap") == 0) mapped = 1;
+            else if (sscanf(token, "bs=%u", &block_size) == 1) continue;
+            else if (sscanf(token, "blocks=%u", &blocks) == 1) continue;
+            else strcpy(image, token);
+        }
+        init_filesystem(image, mapped, block_size, blocks);
+    } else if (strncmp(command, "load", 4) == 0) {
+        /* load [imagem] [mmap] [snap=nome] */
+        char image[256] = DEFAULT_IMAGE, token[256], snapshot[SNAPSHOT_NAME_SIZE] = "";
+        int mapped = 0, used;
+        const char *p = command + 4;
+
+        while (sscanf(p, "%255s%n", token, &used) == 1) {
+            p += used;
+            if (strcmp(token, "mmap") == 0) mapped = 1;
+            else if (sscanf(token, "snap=%23s", snapshot) == 1) continue;
+            else strcpy(image, token);
+        }
+        load_filesystem(image, mapped, snapshot[0] ? snapshot : NULL);
+    } else if (strncmp(command, "ls", 2) == 0) {
+        char path[256];
+        sscanf(command + 3, "%255s", path);
+        ls(path);
+    } else if (strncmp(command, "mkdir", 5) == 0) {
+        char path[256];
+        sscanf(command + 6, "%255s", path);
+        mkdir(path);
+    } else if (strncmp(command, "create", 6) == 0) {
+        char path[256];
+        sscanf(command + 7, "%255s", path);
+        create(path);
+    } else if (strncmp(command, "unlink", 6) == 0) {
+        char path[256];
+        sscanf(command + 7, "%255s", path);
+        unlink(path);
+    } else if (strncmp(command, "write", 5) == 0) {
+        char data[1024], path[256];
+        int rep;
+        if (sscanf(command + 6, "\"%1023[^\"]\" %d %255s", data, &rep, path) == 3) {
             write(data, rep, path);
-        } else if (strncmp(command, "append", 6) == 0) {
-            char data[256], path[256];
-            int rep;
-            sscanf(command + 7, "\"%[^\"]\" %d %s", data, &rep, path);
+        } else {
+            printf("Erro: Uso: write \"dados\" <repetições> <caminho>\n");
+        }
+    } else if (strncmp(command, "append", 6) == 0) {
+        char data[256], path[256];
+        int rep;
+        if (sscanf(command + 7, "\"%255[^\"]\" %d %255s", data, &rep, path) == 3) {
             append(data, rep, path);
-        } else if (strncmp(command, "read", 4) == 0) {
-            char path[256];
-            sscanf(command + 5, "%s", path);
-            read(path);
-        } else if (strncmp(command, "exit", 4) == 0) {
-            break;
-        } else if (strncmp(command, "export", 6) == 0) {
-            char filename[256];
-            sscanf(command + 7, "%s", filename);
-            export_fat_to_file(filename);
         } else {
-            printf("Comando desconhecido: %s", command);
+            printf("Erro: Uso: append \"dados\" <repetições> <caminho>\n");
+        }
+    } else if (strncmp(command, "truncate", 8) == 0) {
+        char path[256];
+        unsigned int size;
+        if (sscanf(command + 9, "%255s %u", path, &size) == 2) {
+            truncate(path, size);
+        }
+    } else if (strncmp(command, "import", 6) == 0) {
+        char host_file[256], path[256];
+        unsigned int length = 0;
+        if (sscanf(command + 7, "%255s %255s %u", host_file, path, &length) >= 2) {
+            import_file(host_file, path, length);
+        }
+    } else if (strncmp(command, "read", 4) == 0) {
+        char path[256];
+        unsigned int offset = 0, length = UINT32_MAX;
+        sscanf(command + 5, "%255s %u %u", path, &offset, &length);
+        read(path, offset, length);
+    } else if (strncmp(command, "sync", 4) == 0) {
+        flush_filesystem();
+        if (!quiet) printf("Imagem sincronizada.\n");
+    } else if (strncmp(command, "cache", 5) == 0) {
+        unsigned int capacity;
+        if (sscanf(command + 5, "%u", &capacity) == 1) {
+            if (cache_resize(capacity) == 0) {
+                if (!quiet) printf("Cache redimensionada para %u blocos.\n", capacity);
+            }
+        } else {
+            cache_print_stats();
+            ra_print_stats();
+            dcache_print_stats();
         }
+    } else if (strncmp(command, "fat", 3) == 0) {
+        char option[16] = "";
+        sscanf(command + 3, "%*s %15s", option);
+        if (strncmp(command + 3, " defer", 6) == 0) {
+            if (strcmp(option, "off") == 0) {
+                fat_deferred = 0;
+                commit_fat();
+            } else {
+                fat_deferred = 1;
+            }
+        }
+        print_fat_stats();
+    } else if (strncmp(command, "alloc", 5) == 0) {
+        char mode[16] = "";
+        sscanf(command + 5, "%15s", mode);
+        if (strcmp(mode, "contig") == 0) alloc_contiguous = 1;
+        else if (strcmp(mode, "first") == 0) alloc_contiguous = 0;
+        printf("Alocação: %s\n", alloc_contiguous ? "contígua" : "primeiro bloco livre");
+    } else if (strncmp(command, "df", 2) == 0) {
+        uint32_t free = free_blocks();
+        uint32_t total = BLOCKS - ROOT_BLOCK - 1;
+        printf("Blocos livres: %u de %u (%llu bytes livres)\n", free, total, (unsigned long long)free * BLOCK_SIZE);
+    } else if (strncmp(command, "aio", 3) == 0) {
+        char mode[16] = "";
+        sscanf(command + 3, "%15s", mode);
+        if (strcmp(mode, "uring") == 0) aio_use_pool(0);
+        else if (strcmp(mode, "threads") == 0) aio_use_pool(1);
+        aio_print_stats();
+    } else if (strncmp(command, "fsck", 4) == 0) {
+        struct fsck_report_s report;
+        char mode[16] = "";
+        sscanf(command + 4, "%15s", mode);
+        int repair = strcmp(mode, "repair") == 0;
+        if (writable()) {
+            fsck_run(repair, &report);
+            fsck_print(&report, repair);
+        }
+    } else if (strncmp(command, "journal", 7) == 0) {
+        char mode[16] = "";
+        sscanf(command + 7, "%15s", mode);
+        int on = strcmp(mode, "on") == 0;
+        if ((on || strcmp(mode, "off") == 0) && writable()) journal_enable(on);
+        journal_print_stats();
+    } else if (strncmp(command, "exit", 4) == 0) {
+        flush_filesystem();
+        aio_drain();
+        dev_close();
+        return 1;
+    } else if (strncmp(command, "export", 6) == 0) {
+        /* export <arquivo> [compact|json] */
+        char filename[256], mode[16] = "";
+        sscanf(command + 7, "%255s %15s", filename, mode);
+        if (strcmp(mode, "compact") == 0) export_fat_compact(filename, 0);
+        else if (strcmp(mode, "json") == 0) export_fat_compact(filename, 1);
+        else export_fat_to_file(filename);
+    } else if (strncmp(command, "snapshot", 8) == 0) {
+        /* snapshot [nome | delete <nome>] */
+        char name[256] = "", target[256] = "";
+        int words = sscanf(command + 8, "%255s %255s", name, target);
+        if (words <= 0) {
+            snapshot_list();
+        } else if (words == 2 && strcmp(name, "delete") == 0) {
+            if (writable() && snapshot_delete(target) == 0 && !quiet) {
+                printf("Snapshot '%s' removido.\n", target);
+            }
+        } else if (writable() && snapshot_create(name) == 0 && !quiet) {
+            printf("Snapshot '%s' criado.\n", name);
+        }
+    } else if (strncmp(command, "stats", 5) == 0) {
+#ifndef FILESYSTEM_NO_STATS
+        char mode[16] = "";
+        sscanf(command + 5, "%15s", mode);
+        if (strcmp(mode, "reset") == 0) stat_reset();
+        else stat_print();
+#else
+        printf("Estatísticas desativadas na compilação.\n");
+#endif
+    } else {
+        printf("Comando desconhecido: %s", command);
+    }
+
+    return 0;
+}
+
+/* Executa uma linha do shell; devolve 1 em exit */
+static int run_command(char *command) {
+#ifndef FILESYSTEM_NO_STATS
+    uint64_t start = stat_now();
+    int op = stat_begin(command);
+    int done = dispatch(command);
+
+    stat_end(op, start);
+    return done;
+#else
+    return dispatch(command);
+#endif
+}
+
+#define BATCH_GROUP    1024     /* comandos entre descargas no modo batch */
+
+/* Descarga de um grupo do modo batch, contada como "(descarga)" */
+static void batch_flush() {
+#ifndef FILESYSTEM_NO_STATS
+    uint64_t start = stat_now();
+    int op = stat_begin("(descarga)");
+#endif
+
+    /* Um único fdatasync cobre os diretórios copiados no mapeamento */
+    if (journal_enabled()) journal_force();
+    flush_filesystem();
+#ifndef FILESYSTEM_NO_STATS
+    stat_end(op, start);
+#endif
+}
+
+/*
+ * Modo batch: "filesystem batch <script> [grupo]". Executa o script sem
+ * prompt nem mensagens de sucesso; a FAT e o diário só vão para a imagem a
+ * cada grupo de comandos (e em sync), não a cada operação. No fim imprime
+ * as estatísticas por comando, zeradas no início; as descargas aparecem
+ * como "(descarga)".
+ */
+static int run_batch(const char *script, uint32_t group) {
+    char command[1024], name[16];
+    int done = 0;
+    uint32_t pending = 0;
+    uint64_t lines = 0, start = stat_now();
+    FILE *f = fopen(script, "r");
+
+    if (!f) {
+        printf("Erro: Não foi possível abrir o script '%s'.\n", script);
+        return 8;
+    }
+    if (group == 0) group = BATCH_GROUP;
+
+#ifndef FILESYSTEM_NO_STATS
+    stat_reset();
+#endif
+    quiet = 1;
+    fat_deferred = 1;
+    while (!done && fgets(command, sizeof(command), f)) {
+        if (sscanf(command, "%15s", name) != 1 || name[0] == '#') continue;
+
+        done = run_command(command);
+        lines++;
+
+        if (strcmp(name, "sync") == 0) {
+            pending = 0;
+        } else if (!done && dev_is_open() && ++pending == group) {
+            batch_flush();
+            pending = 0;
+        }
+    }
+    fclose(f);
+
+    if (!done && dev_is_open()) {
+        batch_flush();
+        aio_drain();
+        dev_close();
+    }
+    quiet = 0;
+
+    double seconds = (stat_now() - start) / 1e9;
+    printf("%llu comandos em %.3f s (%.0f comandos/s)\n",
+           (unsigned long long)lines, seconds, seconds > 0 ? lines / seconds : 0.0);
+#ifndef FILESYSTEM_NO_STATS
+    stat_print();
+#endif
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char command[256];
+
+    if (argc >= 3 && strcmp(argv[1], "fsck") == 0) {
+        return fsck_image(argv[2], argc >= 4 && strcmp(argv[3], "repair") == 0);
+    }
+
+    /* Até o primeiro init ou load vale a geometria padrão, sem imagem */
+    if (set_geometry(DEFAULT_BLOCK_SIZE, DEFAULT_BLOCKS) == -1) return 1;
+    cache_invalidate();
+    alloc_reset();
+    dir_index_reset();
+
+    if (argc >= 3 && strcmp(argv[1], "batch") == 0) {
+        return run_batch(argv[2], argc >= 4 ? (uint32_t)strtoul(argv[3], NULL, 10) : BATCH_GROUP);
+    }
+
+    while (1) {
+        printf("filesystem> ");
+        if (!fgets(command, sizeof(command), stdin)) strcpy(command, "exit\n");
+        if (run_command(command)) break;
     }
 
     return 0;
 }
+#endif
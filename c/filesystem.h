@@ -3,35 +3,106 @@
 
 #include <stdint.h>
 
-#define BLOCK_SIZE        1024
-#define BLOCKS            2048
-#define FAT_SIZE          (BLOCKS * 2)
-#define FAT_BLOCKS        (FAT_SIZE / BLOCK_SIZE)
-#define ROOT_BLOCK        FAT_BLOCKS
+#define DEFAULT_BLOCK_SIZE 1024
+#define DEFAULT_BLOCKS    2048
+#define MIN_BLOCK_SIZE    512
+#define MAX_BLOCK_SIZE    65536
+#define MAX_BLOCKS        (1u << 28)
+#define SUPERBLOCK_MAGIC  0x53463254u   /* "T2FS" */
+#define SUPERBLOCK_VERSION 1
+
+/*
+ * Geometria da imagem aberta, lida do superbloco (bloco 0). Depois dele vêm
+ * a FAT de 32 bits e o diretório raiz; o diário fica após o último bloco.
+ */
+struct geometry_s {
+    uint32_t block_size;
+    uint32_t blocks;
+    uint32_t fat_blocks;
+    uint32_t root_block;
+};
+extern struct geometry_s geometry;
+
+/* Gravado no início do bloco 0 */
+struct superblock_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t blocks;
+    uint32_t fat_start;
+    uint32_t fat_blocks;
+    uint32_t root_block;
+    uint32_t journal_bytes;
+    uint64_t journal_offset;
+};
+
+#define BLOCK_SIZE        geometry.block_size
+#define BLOCKS            geometry.blocks
+#define FAT_START         1
+#define FAT_BLOCKS        geometry.fat_blocks
+#define ROOT_BLOCK        geometry.root_block
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / 4)
 #define DIR_ENTRY_SIZE    32
 #define DIR_ENTRIES       (BLOCK_SIZE / DIR_ENTRY_SIZE)
+#define DIR_NAME_SIZE     23
+#define DIR_NAME_MAX      (DIR_NAME_SIZE - 1)
+#define CHAIN_BATCH_BYTES 65536
+#define CHAIN_BATCH       (CHAIN_BATCH_BYTES / BLOCK_SIZE)
+#define JOURNAL_BYTES     65536
+#define JOURNAL_OFFSET    ((uint64_t)BLOCKS * BLOCK_SIZE)
+#define RESOLVE_OK        0
+#define RESOLVE_MISSING   -1
+#define RESOLVE_NOT_DIR   -2
+#define DEFAULT_IMAGE     "filesystem.dat"
+
+/* Códigos da FAT; números de bloco válidos são sempre menores */
+#define FAT_FREE          0x00000000u
+#define FAT_RESERVED      0x7ffffffeu
+#define FAT_EOF           0x7fffffffu
 
-/* Estrutura da FAT */
-extern uint16_t fat[BLOCKS];
-/* Bloco de dados */
-extern uint8_t data_block[BLOCK_SIZE];
+/* Estrutura da FAT: BLOCKS entradas, completada até o fim do último setor */
+extern uint32_t *fat;
+/* Adia a gravação da FAT até o próximo sync/exit */
+extern int fat_deferred;
+extern int quiet;
+/* Com um snapshot montado: raiz dele e nenhuma alteração aceita */
+extern uint32_t root_dir;
+extern int read_only;
 
 /* Estrutura de entrada de diretório */
 struct dir_entry_s {
-    int8_t filename[25];
+    int8_t filename[DIR_NAME_SIZE];
     uint8_t attributes;
-    uint16_t first_block;
+    uint32_t first_block;
     uint32_t size;
 };
-extern struct dir_entry_s dir_block[DIR_ENTRIES];
+extern struct dir_entry_s *dir_block;
 
 /* Funções para manipulação do sistema de arquivos */
-void read_block(char *file, uint32_t block, uint8_t *record);
-void write_block(char *file, uint32_t block, uint8_t *record);
-void read_fat(char *file, uint16_t *fat);
-void write_fat(char *file, uint16_t *fat);
-void init_filesystem();
-void load_filesystem();
+void read_block(uint32_t block, uint8_t *record);
+void write_block(uint32_t block, uint8_t *record);
+const uint8_t *view_block(uint32_t block, uint8_t *buf);
+uint32_t chain_blocks(uint32_t block, uint32_t *blocks, uint32_t max);
+struct aio_batch_s;
+void read_chain_submit(const uint32_t *blocks, uint32_t count, uint8_t *buf, struct aio_batch_s *batch);
+void read_chain_wait(const uint32_t *blocks, uint32_t count, uint8_t *buf, struct aio_batch_s *batch);
+void read_chain(const uint32_t *blocks, uint32_t count, uint8_t *buf);
+void write_chain(const uint32_t *blocks, uint32_t count, const uint8_t *buf, struct aio_batch_s *batch);
+void read_fat(uint32_t *fat);
+void write_fat(uint32_t *fat);
+void set_fat(uint32_t block, uint32_t value);
+void free_chain(uint32_t block);
+void commit_fat();
+void init_filesystem(const char *image, int mapped, uint32_t block_size, uint32_t blocks);
+void load_filesystem(const char *image, int mapped, const char *snapshot);
+void flush_filesystem();
+int writable();
 void map_directory(uint32_t block);
 
+struct dentry_s;
+int resolve_path(const char *path, struct dentry_s *dentry);
+int find_file_block(const char *path);
+int find_directory_block(const char *path);
+int write_buffer(const uint8_t *data, uint32_t length, uint32_t rep, const char *path, int appending);
+
 #endif
@@ -0,0 +1,367 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "alloc.h"
+#include "dirindex.h"
+#include "dcache.h"
+#include "blockmap.h"
+#include "readahead.h"
+#include "locks.h"
+#include "directory.h"
+#include "fsck.h"
+
+#define NONE 0xffffffffu
+
+struct fsck_s {
+    int repair;
+    struct fsck_report_s *report;
+    _Atomic uint64_t *visited;
+    _Atomic uint32_t *owner;        /* cadeia que marcou o bloco; 0 até ela gravar (ids começam em 1) */
+    _Atomic uint32_t next_id;
+    /* Subdiretórios da raiz, distribuídos entre as threads */
+    uint32_t *tasks;
+    char (*task_names)[DCACHE_PATH_MAX];
+    uint32_t task_count;
+    uint32_t task_capacity;
+    _Atomic uint32_t next_task;
+};
+
+static struct fsck_s ctx;
+/* ctx é global: uma verificação por vez */
+static pthread_mutex_t fsck_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* 1 se o bloco ainda não tinha sido visitado */
+static int claim(uint32_t block) {
+    uint64_t bit = (uint64_t)1 << (block % 64);
+
+    return !(atomic_fetch_or(&ctx.visited[block / 64], bit) & bit);
+}
+
+static int claimed(uint32_t block) {
+    return (atomic_load(&ctx.visited[block / 64]) >> (block % 64)) & 1;
+}
+
+static void problem(_Atomic uint32_t *counter, const char *path, const char *message, uint32_t block) {
+    atomic_fetch_add(counter, 1);
+    printf("fsck: %s: %s (bloco %u)\n", path, message, block);
+}
+
+/*
+ * Percorre a cadeia a partir de first, marcando os blocos. Devolve quantos
+ * blocos válidos ela tem; 0 se o próprio primeiro bloco é inválido. Com
+ * repair, a cadeia termina no último bloco bom.
+ */
+static uint32_t walk_chain(uint32_t first, const char *path) {
+    uint32_t id = atomic_fetch_add(&ctx.next_id, 1);
+    uint32_t block = first, prev = NONE, count = 0;
+
+    while (1) {
+        if (block <= ROOT_BLOCK || block >= BLOCKS || fat[block] == FAT_RESERVED) {
+            problem(&ctx.report->bad_pointers, path, "aponta para fora da área de dados", block);
+        } else if (fat[block] == FAT_FREE) {
+            problem(&ctx.report->bad_pointers, path, "aponta para um bloco livre", block);
+        } else if (!claim(block)) {
+            if (atomic_load(&ctx.owner[block]) == id) problem(&ctx.report->cycles, path, "cadeia com ciclo", block);
+            else problem(&ctx.report->cross_links, path, "bloco compartilhado com outra cadeia", block);
+        } else {
+            atomic_store(&ctx.owner[block], id);
+            count++;
+            if (fat[block] == FAT_EOF) return count;
+            prev = block;
+            block = fat[block];
+            continue;
+        }
+
+        if (ctx.repair && prev != NONE) {
+            link_block(prev, FAT_EOF);
+            atomic_fetch_add(&ctx.report->repaired, 1);
+        }
+        return count;
+    }
+}
+
+/* Libera os blocos da cadeia depois dos keep primeiros */
+static void trim_chain(uint32_t first, uint32_t keep) {
+    uint32_t tail = first;
+
+    for (uint32_t i = 1; i < keep; i++) {
+        tail = fat[tail];
+    }
+
+    uint32_t block = fat[tail];
+    link_block(tail, FAT_EOF);
+    while (block != FAT_EOF) {
+        uint32_t next = fat[block];
+        link_block(block, FAT_FREE);
+        block = next;
+    }
+}
+
+/*
+ * Confere a cadeia de uma entrada contra o tamanho; devolve quantos blocos
+ * ela tem, 0 se a entrada deve sumir. Diretórios crescem sem tamanho.
+ */
+static uint32_t check_entry(struct dir_entry_s *entry, const char *path, int *changed) {
+    uint32_t expected = 1;
+    uint32_t count;
+
+    if (entry->attributes != 0x01 && entry->attributes != 0x02) {
+        problem(&ctx.report->bad_entries, path, "atributos inválidos", entry->first_block);
+        return 0;
+    }
+    if (entry->filename[0] == '\0' || memchr(entry->filename, '\0', sizeof(entry->filename)) == NULL) {
+        problem(&ctx.report->bad_entries, path, "nome inválido", entry->first_block);
+        return 0;
+    }
+
+    count = walk_chain(entry->first_block, path);
+    if (count == 0) return 0;
+
+    if (entry->attributes == 0x01) {
+        atomic_fetch_add(&ctx.report->files, 1);
+        if (entry->size > 0) expected = (entry->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    } else {
+        atomic_fetch_add(&ctx.report->directories, 1);
+        expected = count;
+    }
+
+    if (count > expected) {
+        problem(&ctx.report->size_mismatches, path, "cadeia maior que o tamanho", entry->first_block);
+        if (ctx.repair) {
+            trim_chain(entry->first_block, expected);
+            atomic_fetch_add(&ctx.report->repaired, 1);
+            count = expected;
+        }
+    } else if (count < expected) {
+        problem(&ctx.report->size_mismatches, path, "tamanho maior que a cadeia", entry->first_block);
+        if (ctx.repair) {
+            entry->size = count * BLOCK_SIZE;
+            *changed = 1;
+            atomic_fetch_add(&ctx.report->repaired, 1);
+        }
+    }
+    atomic_fetch_add(&ctx.report->blocks, count);
+    return count;
+}
+
+/* Guarda um subdiretório da raiz como tarefa para as threads */
+static int add_task(uint32_t block, uint32_t length, const char *path) {
+    if (ctx.task_count == ctx.task_capacity) {
+        uint32_t capacity = ctx.task_capacity ? 2 * ctx.task_capacity : DIR_ENTRIES;
+        uint32_t *tasks = realloc(ctx.tasks, (size_t)capacity * 2 * sizeof(uint32_t));
+        if (!tasks) return -1;
+        ctx.tasks = tasks;
+        char (*names)[DCACHE_PATH_MAX] = realloc(ctx.task_names, (size_t)capacity * DCACHE_PATH_MAX);
+        if (!names) return -1;
+        ctx.task_names = names;
+        ctx.task_capacity = capacity;
+    }
+    ctx.tasks[2 * ctx.task_count] = block;
+    ctx.tasks[2 * ctx.task_count + 1] = length;
+    strcpy(ctx.task_names[ctx.task_count], path);
+    ctx.task_count++;
+    return 0;
+}
+
+/*
+ * Blocos de entradas de um diretório cuja cadeia (length blocos) já foi
+ * marcada. Um cabeçalho de baldes que não bate com a cadeia é apagado com
+ * repair: o diretório volta a ser lido em ordem de cadeia.
+ */
+static uint32_t entry_blocks(uint32_t block, uint32_t length, const char *path, uint32_t *blocks) {
+    _Alignas(uint64_t) uint8_t header_data[BLOCK_SIZE];
+    struct dir_entry_s *header = (struct dir_entry_s *)header_data;
+    uint32_t count = chain_blocks(block, blocks, length);
+
+    read_block(block, header_data);
+    if (header[0].attributes != DIR_ATTR_HASHED) return count;
+
+    uint32_t buckets = header[0].first_block;
+    if (buckets != 0 && (buckets & (buckets - 1)) == 0 && buckets == count - 1) {
+        memmove(blocks, blocks + 1, (count - 1) * sizeof(uint32_t));
+        return count - 1;
+    }
+
+    problem(&ctx.report->bad_entries, path, "cabeçalho de baldes inválido", block);
+    if (ctx.repair) {
+        memset(&header[0], 0, sizeof(header[0]));
+        write_block(block, header_data);
+        atomic_fetch_add(&ctx.report->repaired, 1);
+    }
+    return count;
+}
+
+/*
+ * Verifica as entradas de um diretório já marcado e desce nos
+ * subdiretórios. Com collect, os subdiretórios viram tarefas para as
+ * threads em vez de serem percorridos aqui.
+ */
+static void check_directory(uint32_t block, uint32_t length, const char *path, int collect) {
+    /* Na heap: a recursão com blocos grandes esgotaria a pilha */
+    uint32_t *blocks = malloc((size_t)length * sizeof(uint32_t));
+    uint8_t *dir_data = malloc((size_t)length * BLOCK_SIZE);
+    char child[DCACHE_PATH_MAX];
+    uint32_t count, children;
+
+    if (!blocks || !dir_data) {
+        printf("fsck: %s: memória insuficiente, diretório não verificado\n", path);
+        free(blocks);
+        free(dir_data);
+        return;
+    }
+
+    count = entry_blocks(block, length, path, blocks);
+    read_chain(blocks, count, dir_data);
+    for (uint32_t b = 0; b < count; b++) {
+        struct dir_entry_s *entries = (struct dir_entry_s *)(dir_data + (size_t)b * BLOCK_SIZE);
+        int changed = 0;
+
+        for (uint32_t i = 0; i < DIR_ENTRIES; i++) {
+            if (entries[i].attributes == 0x00) continue;
+
+            snprintf(child, sizeof(child), "%s/%.22s", strcmp(path, "/") == 0 ? "" : path, (char *)entries[i].filename);
+            children = check_entry(&entries[i], child, &changed);
+            if (children == 0) {
+                if (ctx.repair) {
+                    memset(&entries[i], 0, sizeof(entries[i]));
+                    changed = 1;
+                    atomic_fetch_add(&ctx.report->repaired, 1);
+                }
+                continue;
+            }
+
+            if (entries[i].attributes != 0x02) continue;
+            if (!collect || add_task(entries[i].first_block, children, child) == -1) {
+                check_directory(entries[i].first_block, children, child, 0);
+            }
+        }
+
+        if (changed) write_block(blocks[b], (uint8_t *)entries);
+    }
+
+    free(blocks);
+    free(dir_data);
+}
+
+static void *worker(void *unused) {
+    uint32_t task;
+
+    (void)unused;
+    while ((task = atomic_fetch_add(&ctx.next_task, 1)) < ctx.task_count) {
+        check_directory(ctx.tasks[2 * task], ctx.tasks[2 * task + 1], ctx.task_names[task], 0);
+    }
+    return NULL;
+}
+
+/* Blocos reservados e blocos ocupados que nenhuma cadeia alcança */
+static void check_unreachable() {
+    for (uint32_t i = 0; i < ROOT_BLOCK; i++) {
+        if (fat[i] != FAT_RESERVED) {
+            problem(&ctx.report->reserved, "FAT", "bloco reservado com código errado", i);
+            if (ctx.repair) {
+                link_block(i, FAT_RESERVED);
+                atomic_fetch_add(&ctx.report->repaired, 1);
+            }
+        }
+    }
+
+    for (uint32_t i = ROOT_BLOCK + 1; i < BLOCKS; i++) {
+        if (fat[i] != FAT_FREE && !claimed(i)) {
+            problem(&ctx.report->orphans, "FAT", "bloco ocupado sem dono", i);
+            if (ctx.repair) {
+                link_block(i, FAT_FREE);
+                atomic_fetch_add(&ctx.report->repaired, 1);
+            }
+        }
+    }
+}
+
+static void free_context() {
+    free((void *)ctx.visited);
+    free(ctx.owner);
+    free(ctx.tasks);
+    free(ctx.task_names);
+}
+
+uint32_t fsck_problems(const struct fsck_report_s *report) {
+    return report->cycles + report->cross_links + report->bad_pointers + report->size_mismatches +
+           report->bad_entries + report->orphans + report->reserved;
+}
+
+/* Verifica (e, com repair, corrige) a imagem carregada; devolve o número de problemas */
+uint32_t fsck_run(int repair, struct fsck_report_s *report) {
+    pthread_t threads[FSCK_THREADS];
+    int started = 0;
+
+    pthread_mutex_lock(&fsck_mutex);
+    ns_lock_write();
+
+    memset(report, 0, sizeof(*report));
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.repair = repair;
+    ctx.report = report;
+    ctx.next_id = 1;
+    ctx.visited = calloc((BLOCKS + 63) / 64, sizeof(uint64_t));
+    ctx.owner = calloc(BLOCKS, sizeof(uint32_t));
+    if (!ctx.visited || !ctx.owner) {
+        printf("fsck: memória insuficiente para %u blocos\n", BLOCKS);
+        free_context();
+        ns_unlock();
+        pthread_mutex_unlock(&fsck_mutex);
+        return UINT32_MAX;  /* não verificada: não pode passar por íntegra */
+    }
+
+    /* A raiz começa em bloco fixo; o resto da cadeia é conferido como qualquer outro */
+    uint32_t root_length = 1;
+    claim(ROOT_BLOCK);
+    atomic_fetch_add(&report->directories, 1);
+    atomic_fetch_add(&report->blocks, 1);
+    if (fat[ROOT_BLOCK] != FAT_EOF) {
+        uint32_t rest = walk_chain(fat[ROOT_BLOCK], "/");
+        if (rest == 0 && repair) {
+            link_block(ROOT_BLOCK, FAT_EOF);
+            atomic_fetch_add(&report->repaired, 1);
+        }
+        root_length += rest;
+        atomic_fetch_add(&report->blocks, rest);
+    }
+
+    check_directory(ROOT_BLOCK, root_length, "/", 1);
+    for (int i = 0; i < FSCK_THREADS; i++) {
+        if (pthread_create(&threads[started], NULL, worker, NULL) == 0) started++;
+    }
+    worker(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    check_unreachable();
+    free_context();
+
+    if (report->repaired > 0) {
+        /* Entradas e cadeias mudaram por baixo dos índices em memória */
+        dir_index_reset();
+        dcache_reset();
+        block_map_reset();
+        ra_reset();
+        flush_filesystem();
+    }
+
+    ns_unlock();
+    pthread_mutex_unlock(&fsck_mutex);
+    return fsck_problems(report);
+}
+
+void fsck_print(const struct fsck_report_s *report, int repair) {
+    printf("fsck: %u diretórios, %u arquivos, %u blocos em uso\n",
+           report->directories, report->files, report->blocks);
+    printf("Problemas: %u (ciclos: %u, cadeias cruzadas: %u, ponteiros inválidos: %u, tamanhos: %u, "
+           "entradas inválidas: %u, órfãos: %u, reservados: %u)\n",
+           fsck_problems(report), report->cycles, report->cross_links, report->bad_pointers,
+           report->size_mismatches, report->bad_entries, report->orphans, report->reserved);
+    if (repair) printf("Correções: %u\n", report->repaired);
+}
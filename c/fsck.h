@@ -0,0 +1,31 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include <stdint.h>
+
+#define FSCK_THREADS      4
+
+/*
+ * Verificação da imagem em uma passada: cada bloco alcançável é marcado uma
+ * só vez num mapa de visitados, então o trabalho é O(BLOCKS). As subárvores
+ * da raiz são verificadas em paralelo.
+ */
+struct fsck_report_s {
+    _Atomic uint32_t directories;
+    _Atomic uint32_t files;
+    _Atomic uint32_t blocks;
+    _Atomic uint32_t cycles;
+    _Atomic uint32_t cross_links;
+    _Atomic uint32_t bad_pointers;
+    _Atomic uint32_t size_mismatches;
+    _Atomic uint32_t bad_entries;
+    _Atomic uint32_t orphans;
+    _Atomic uint32_t reserved;
+    _Atomic uint32_t repaired;
+};
+
+uint32_t fsck_problems(const struct fsck_report_s *report);
+uint32_t fsck_run(int repair, struct fsck_report_s *report);
+void fsck_print(const struct fsck_report_s *report, int repair);
+
+#endif
@@ -0,0 +1,388 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "device.h"
+#include "cache.h"
+#include "journal.h"
+
+/* Primeiros bytes da área do diário; os registros vêm logo depois */
+struct journal_header_s {
+    uint32_t magic;
+    uint32_t epoch;
+};
+
+/* Registros de uma época anterior ao último checkpoint são ignorados */
+struct journal_record_s {
+    uint32_t magic;
+    uint32_t epoch;
+    uint32_t length;
+    uint32_t fat_count;
+    uint32_t dir_count;
+    uint32_t checksum;
+};
+
+struct journal_fat_s {
+    uint32_t block;
+    uint32_t value;
+};
+
+struct journal_dir_s {
+    uint32_t block;
+    uint32_t slot;
+    struct dir_entry_s entry;
+};
+
+/* Unidade de regravação do fim do diário, independente do tamanho do bloco */
+#define JOURNAL_SECTOR 512
+
+#define MAX_FAT_ITEMS ((JOURNAL_BYTES - sizeof(struct journal_header_s) - sizeof(struct journal_record_s)) / \
+                       sizeof(struct journal_fat_s))
+
+/* Registro em montagem pela thread atual */
+static _Thread_local struct {
+    int active;
+    int overflow;
+    uint32_t fat_count;
+    uint32_t fat_capacity;
+    struct journal_fat_s *fat;
+    uint32_t dir_count;
+    struct journal_dir_s dir[JOURNAL_DIR_ITEMS];
+    uint64_t last_seq;
+} tx;
+
+struct journal_stats_s journal_stats;
+
+static int enabled = 1;
+static uint32_t epoch = 0;
+static _Alignas(uint64_t) uint8_t log_buf[JOURNAL_BYTES];
+static uint32_t log_end = sizeof(struct journal_header_s);     /* fim dos registros anexados */
+static uint32_t log_synced = sizeof(struct journal_header_s);  /* já gravado e sincronizado */
+static _Atomic uint64_t append_seq = 0;
+static _Atomic uint64_t durable_seq = 0;
+/* Um registro da FAT ou do diretório foi perdido: o próximo commit faz checkpoint */
+static atomic_int overflowed = 0;
+
+/*
+ * cp_lock: compartilhada pelas operações entre begin e end, exclusiva no
+ * checkpoint. log_mutex protege o buffer; commit_mutex, a gravação dele.
+ * Ordem: cp_lock -> commit_mutex -> log_mutex.
+ */
+static pthread_rwlock_t cp_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t commit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t hash_bytes(uint32_t hash, const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Cabeçalho sem o próprio checksum, seguido da FAT e das entradas de diretório */
+static uint32_t record_checksum(const struct journal_record_s *record, const void *fat, const void *dir) {
+    uint32_t hash = 2166136261u;
+
+    hash = hash_bytes(hash, (const uint8_t *)record, offsetof(struct journal_record_s, checksum));
+    hash = hash_bytes(hash, fat, record->fat_count * sizeof(struct journal_fat_s));
+    return hash_bytes(hash, dir, record->dir_count * sizeof(struct journal_dir_s));
+}
+
+int journal_enabled() {
+    return enabled;
+}
+
+void journal_begin() {
+    if (!enabled) return;
+
+    pthread_rwlock_rdlock(&cp_lock);
+    tx.active = 1;
+    tx.overflow = 0;
+    tx.fat_count = 0;
+    tx.dir_count = 0;
+}
+
+/* Chamado por set_fat; fora de uma operação (replay, init) não registra nada */
+void journal_fat(uint32_t block, uint32_t value) {
+    if (!tx.active || tx.overflow) return;
+
+    if (tx.fat_count == tx.fat_capacity) {
+        uint32_t capacity = tx.fat_capacity ? tx.fat_capacity * 2 : 64;
+        struct journal_fat_s *fat;
+
+        if (capacity > MAX_FAT_ITEMS) capacity = MAX_FAT_ITEMS;
+        if (tx.fat_count == capacity || !(fat = realloc(tx.fat, capacity * sizeof(struct journal_fat_s)))) {
+            tx.overflow = 1;
+            return;
+        }
+        tx.fat = fat;
+        tx.fat_capacity = capacity;
+    }
+
+    tx.fat[tx.fat_count].block = block;
+    tx.fat[tx.fat_count].value = value;
+    tx.fat_count++;
+}
+
+void journal_dir(uint32_t block, int slot, const struct dir_entry_s *entry) {
+    if (!tx.active || tx.overflow) return;
+
+    if (tx.dir_count == JOURNAL_DIR_ITEMS) {
+        tx.overflow = 1;
+        return;
+    }
+    tx.dir[tx.dir_count].block = block;
+    tx.dir[tx.dir_count].slot = slot;
+    tx.dir[tx.dir_count].entry = *entry;
+    tx.dir_count++;
+}
+
+/* Na releitura o bloco é zerado antes dos itens seguintes do registro */
+void journal_zero(uint32_t block) {
+    struct dir_entry_s empty;
+
+    memset(&empty, 0, sizeof(empty));
+    journal_dir(block, JOURNAL_ZERO_SLOT, &empty);
+}
+
+/* Copia o registro da thread para o buffer do diário; 0 se não coube */
+static int append() {
+    struct journal_record_s record = {
+        JOURNAL_MAGIC, epoch, 0, tx.fat_count, tx.dir_count, 0
+    };
+    uint32_t fat_bytes = tx.fat_count * sizeof(struct journal_fat_s);
+    uint32_t dir_bytes = tx.dir_count * sizeof(struct journal_dir_s);
+
+    record.length = sizeof(record) + fat_bytes + dir_bytes;
+    record.checksum = record_checksum(&record, tx.fat, tx.dir);
+
+    pthread_mutex_lock(&log_mutex);
+    if (log_end + record.length > JOURNAL_BYTES) {
+        pthread_mutex_unlock(&log_mutex);
+        return 0;
+    }
+    memcpy(&log_buf[log_end], &record, sizeof(record));
+    /* Sem itens de FAT, tx.fat pode nem ter sido alocado */
+    if (fat_bytes) memcpy(&log_buf[log_end + sizeof(record)], tx.fat, fat_bytes);
+    if (dir_bytes) memcpy(&log_buf[log_end + sizeof(record) + fat_bytes], tx.dir, dir_bytes);
+    log_end += record.length;
+    tx.last_seq = atomic_fetch_add(&append_seq, 1) + 1;
+    journal_stats.records++;
+    pthread_mutex_unlock(&log_mutex);
+    return 1;
+}
+
+/*
+ * Fecha o registro da operação. Um registro que não coube no diário é
+ * descartado: a operação fica como antes do diário, sem atomicidade, até o
+ * checkpoint feito pelo próximo commit.
+ */
+static void close_record() {
+    if (!tx.overflow && (tx.fat_count || tx.dir_count)) {
+        if (!append()) tx.overflow = 1;
+    }
+    if (tx.overflow) {
+        atomic_store(&overflowed, 1);
+        journal_stats.overflows++;
+    }
+}
+
+void journal_end() {
+    if (!tx.active) return;
+
+    tx.active = 0;
+    close_record();
+    pthread_rwlock_unlock(&cp_lock);
+}
+
+/*
+ * Fecha o registro e abre outro na mesma operação, sem soltar cp_lock. Os
+ * blocos descritos pelo primeiro já podem ir para a cache.
+ */
+void journal_split() {
+    if (!tx.active) return;
+
+    close_record();
+    tx.overflow = 0;
+    tx.fat_count = 0;
+    tx.dir_count = 0;
+}
+
+/*
+ * Torna duráveis os registros até seq. Quem pega commit_mutex grava tudo o
+ * que foi anexado até então: as threads que esperavam na trava encontram o
+ * próprio registro já gravado e saem sem outro fdatasync.
+ */
+static void write_log(uint64_t seq) {
+    if (atomic_load(&durable_seq) >= seq) return;
+
+    pthread_mutex_lock(&commit_mutex);
+    if (atomic_load(&durable_seq) < seq) {
+        pthread_mutex_lock(&log_mutex);
+        uint32_t end = log_end;
+        uint64_t end_seq = atomic_load(&append_seq);
+        pthread_mutex_unlock(&log_mutex);
+
+        /* O setor parcial do fim anterior é regravado inteiro */
+        uint32_t from = log_synced / JOURNAL_SECTOR * JOURNAL_SECTOR;
+        dev_pwrite(&log_buf[from], end - from, JOURNAL_OFFSET + from);
+        dev_datasync();
+        log_synced = end;
+        atomic_store(&durable_seq, end_seq);
+        journal_stats.commits++;
+    }
+    pthread_mutex_unlock(&commit_mutex);
+}
+
+/* Regra do WAL: a cache chama antes de gravar blocos de diretório no lugar */
+void journal_force() {
+    write_log(atomic_load(&append_seq));
+}
+
+/* Nova época: os registros anteriores deixam de valer */
+static void reset_log() {
+    struct journal_header_s header = { JOURNAL_MAGIC, ++epoch };
+
+    pthread_mutex_lock(&commit_mutex);
+    pthread_mutex_lock(&log_mutex);
+    memcpy(log_buf, &header, sizeof(header));
+    log_end = log_synced = sizeof(header);
+    dev_pwrite(&header, sizeof(header), JOURNAL_OFFSET);
+    dev_datasync();
+    atomic_store(&durable_seq, atomic_load(&append_seq));
+    atomic_store(&overflowed, 0);
+    pthread_mutex_unlock(&log_mutex);
+    pthread_mutex_unlock(&commit_mutex);
+}
+
+/* Chamar sem operações entre begin e end */
+static void checkpoint_locked() {
+    journal_force();
+    write_fat(fat);
+    cache_flush();
+    dev_sync();
+    reset_log();
+    journal_stats.checkpoints++;
+}
+
+/* Grava a FAT e os diretórios no lugar e esvazia o diário */
+void journal_checkpoint() {
+    /* Sem imagem não há o que gravar nem diário para esvaziar */
+    if (!dev_is_open()) return;
+
+    pthread_rwlock_wrlock(&cp_lock);
+    checkpoint_locked();
+    pthread_rwlock_unlock(&cp_lock);
+}
+
+/*
+ * Fim de operação: espera o registro da thread (a menos que a FAT esteja
+ * adiada) e faz checkpoint se preciso
+ */
+void journal_commit() {
+    uint32_t used;
+
+    if (!fat_deferred) write_log(tx.last_seq);
+
+    pthread_mutex_lock(&log_mutex);
+    used = log_end;
+    pthread_mutex_unlock(&log_mutex);
+
+    if (atomic_load(&overflowed) || used > JOURNAL_BYTES / 2) journal_checkpoint();
+}
+
+/* Imagem nova: diário vazio */
+void journal_format() {
+    epoch = 0;
+    reset_log();
+}
+
+static int apply(const struct journal_record_s *record) {
+    const struct journal_fat_s *fat_items = (const void *)(record + 1);
+    const struct journal_dir_s *dir_items = (const void *)(fat_items + record->fat_count);
+    _Alignas(uint64_t) uint8_t dir_data[BLOCK_SIZE];
+
+    if (record_checksum(record, fat_items, dir_items) != record->checksum) return 0;
+
+    for (uint32_t i = 0; i < record->fat_count; i++) {
+        if (fat_items[i].block < BLOCKS) set_fat(fat_items[i].block, fat_items[i].value);
+    }
+    for (uint32_t i = 0; i < record->dir_count; i++) {
+        if (dir_items[i].block >= BLOCKS) continue;
+        if (dir_items[i].slot == JOURNAL_ZERO_SLOT) {
+            memset(dir_data, 0, BLOCK_SIZE);
+            write_block(dir_items[i].block, dir_data);
+            continue;
+        }
+        if (dir_items[i].slot >= DIR_ENTRIES) continue;
+        read_block(dir_items[i].block, dir_data);
+        memcpy(&dir_data[dir_items[i].slot * DIR_ENTRY_SIZE], &dir_items[i].entry, DIR_ENTRY_SIZE);
+        write_block(dir_items[i].block, dir_data);
+    }
+    return 1;
+}
+
+/*
+ * Reaplica os registros válidos da época atual, em ordem, sobre a FAT já
+ * lida. Para no primeiro registro incompleto: é o que estava sendo gravado.
+ */
+void journal_replay() {
+    const struct journal_header_s *header = (const void *)log_buf;
+    uint32_t offset = sizeof(struct journal_header_s);
+    uint32_t count = 0;
+
+    dev_pread(log_buf, JOURNAL_BYTES, JOURNAL_OFFSET);
+    if (header->magic != JOURNAL_MAGIC) {
+        journal_format();
+        return;
+    }
+    epoch = header->epoch;
+
+    while (offset + sizeof(struct journal_record_s) <= JOURNAL_BYTES) {
+        const struct journal_record_s *record = (const void *)&log_buf[offset];
+
+        if (record->magic != JOURNAL_MAGIC || record->epoch != epoch ||
+            record->fat_count > MAX_FAT_ITEMS || record->dir_count > JOURNAL_DIR_ITEMS ||
+            record->length != sizeof(*record) + record->fat_count * sizeof(struct journal_fat_s) +
+                              record->dir_count * sizeof(struct journal_dir_s) ||
+            offset + record->length > JOURNAL_BYTES || !apply(record)) {
+            break;
+        }
+        offset += record->length;
+        count++;
+    }
+
+    if (count > 0) {
+        write_fat(fat);
+        cache_flush();
+        dev_sync();
+        journal_stats.replayed += count;
+        printf("Diário: %u registros reaplicados.\n", count);
+    }
+    reset_log();
+}
+
+/* Troca de modo: o checkpoint deixa a imagem completa nos dois sentidos */
+void journal_enable(int on) {
+    journal_checkpoint();
+    enabled = on;
+}
+
+void journal_print_stats() {
+    uint32_t used;
+
+    pthread_mutex_lock(&log_mutex);
+    used = log_end;
+    pthread_mutex_unlock(&log_mutex);
+
+    printf("Diário: %s, %u de %u bytes em uso, época %u\n", enabled ? "ativo" : "desligado",
+           used, JOURNAL_BYTES, epoch);
+    printf("Registros: %llu, gravações (fdatasync): %llu, checkpoints: %llu, estouros: %llu, reaplicados: %llu\n",
+           (unsigned long long)journal_stats.records, (unsigned long long)journal_stats.commits,
+           (unsigned long long)journal_stats.checkpoints, (unsigned long long)journal_stats.overflows,
+           (unsigned long long)journal_stats.replayed);
+}
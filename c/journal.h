@@ -0,0 +1,46 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include "filesystem.h"
+
+#define JOURNAL_MAGIC     0x4c4e524au   /* "JRNL" */
+#define JOURNAL_DIR_ITEMS 4
+#define JOURNAL_ZERO_SLOT 0xffffffffu   /* item que zera o bloco inteiro */
+
+/*
+ * Diário de metadados (redo): cada operação registra as entradas da FAT e
+ * as entradas de diretório que alterou num único registro. Os registros
+ * vão para a área após o último bloco e ficam duráveis com um fdatasync
+ * compartilhado por quem esperar junto. A FAT e os diretórios só são
+ * gravados no lugar no checkpoint, quando o diário passa da metade.
+ *
+ * Uma operação fica entre journal_begin e journal_end; journal_end vem
+ * antes de gravar o bloco de diretório, e commit_fat espera o registro.
+ */
+struct journal_stats_s {
+    uint64_t records;
+    uint64_t commits;
+    uint64_t checkpoints;
+    uint64_t overflows;
+    uint64_t replayed;
+};
+extern struct journal_stats_s journal_stats;
+
+void journal_begin();
+void journal_fat(uint32_t block, uint32_t value);
+void journal_dir(uint32_t block, int slot, const struct dir_entry_s *entry);
+void journal_zero(uint32_t block);
+void journal_end();
+void journal_split();
+void journal_commit();
+void journal_force();
+void journal_checkpoint();
+
+void journal_format();
+void journal_replay();
+int journal_enabled();
+void journal_enable(int enabled);
+void journal_print_stats();
+
+#endif
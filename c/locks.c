@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "locks.h"
+
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t dir_locks[DIR_LOCKS];
+static pthread_rwlock_t inode_locks[INODE_LOCKS];
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+
+static void locks_init() {
+    for (int i = 0; i < DIR_LOCKS; i++) {
+        pthread_rwlock_init(&dir_locks[i], NULL);
+    }
+    for (int i = 0; i < INODE_LOCKS; i++) {
+        pthread_rwlock_init(&inode_locks[i], NULL);
+    }
+}
+
+static pthread_rwlock_t *dir_lock(uint32_t block) {
+    pthread_once(&locks_once, locks_init);
+    return &dir_locks[block % DIR_LOCKS];
+}
+
+static pthread_rwlock_t *inode_lock(uint32_t block) {
+    pthread_once(&locks_once, locks_init);
+    return &inode_locks[block % INODE_LOCKS];
+}
+
+void ns_lock_read() {
+    pthread_rwlock_rdlock(&ns_lock);
+}
+
+void ns_lock_write() {
+    pthread_rwlock_wrlock(&ns_lock);
+}
+
+void ns_unlock() {
+    pthread_rwlock_unlock(&ns_lock);
+}
+
+void dir_lock_read(uint32_t block) {
+    pthread_rwlock_rdlock(dir_lock(block));
+}
+
+void dir_lock_write(uint32_t block) {
+    pthread_rwlock_wrlock(dir_lock(block));
+}
+
+void dir_unlock(uint32_t block) {
+    pthread_rwlock_unlock(dir_lock(block));
+}
+
+void inode_lock_read(uint32_t block) {
+    pthread_rwlock_rdlock(inode_lock(block));
+}
+
+void inode_lock_write(uint32_t block) {
+    pthread_rwlock_wrlock(inode_lock(block));
+}
+
+void inode_unlock(uint32_t block) {
+    pthread_rwlock_unlock(inode_lock(block));
+}
@@ -0,0 +1,30 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <stdint.h>
+
+#define DIR_LOCKS         64
+#define INODE_LOCKS       64
+
+/*
+ * Ordem de aquisição: namespace -> inode -> diretório -> grupos de alocação
+ * (em ordem crescente) -> travas internas (cache, índices). Diretórios e
+ * inodes usam travas distribuídas pelo número do bloco.
+ *
+ * A trava de namespace é compartilhada por todas as operações e exclusiva
+ * só na remoção de diretórios, o único caso em que um diretório some, e
+ * nas passadas pela árvore inteira (fsck, snapshots).
+ */
+void ns_lock_read();
+void ns_lock_write();
+void ns_unlock();
+
+void dir_lock_read(uint32_t block);
+void dir_lock_write(uint32_t block);
+void dir_unlock(uint32_t block);
+
+void inode_lock_read(uint32_t block);
+void inode_lock_write(uint32_t block);
+void inode_unlock(uint32_t block);
+
+#endif
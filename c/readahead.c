@@ -0,0 +1,98 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "cache.h"
+#include "readahead.h"
+
+struct ra_state_s {
+    int valid;
+    uint32_t first_block;
+    uint32_t next;      /* bloco lógico seguinte ao fim da última leitura */
+    uint32_t ahead;     /* blocos lógicos antes deste já foram pedidos */
+    uint32_t window;
+};
+
+struct ra_stats_s ra_stats;
+
+static struct ra_state_s states[RA_SLOTS];
+static pthread_mutex_t ra_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* A janela não passa de metade da cache: o que é lido antes não pode expulsar o resto */
+static uint32_t ra_limit() {
+    uint32_t capacity = cache_capacity() ? cache_capacity() : CACHE_DEFAULT_BLOCKS;
+    uint32_t limit = capacity / 2 < RA_MAX_BLOCKS ? capacity / 2 : RA_MAX_BLOCKS;
+
+    return limit ? limit : 1;
+}
+
+uint32_t ra_grow(uint32_t window) {
+    uint32_t limit = ra_limit();
+
+    window = window ? window * 2 : RA_MIN_BLOCKS;
+    return window < limit ? window : limit;
+}
+
+/*
+ * Registra a leitura dos blocos lógicos [start, end) de um arquivo com count
+ * blocos. Devolve quantos blocos pedir antecipadamente a partir de *from.
+ * A primeira leitura do início do arquivo já conta como sequencial.
+ */
+uint32_t ra_next(uint32_t first_block, uint32_t start, uint32_t end, uint32_t count, uint32_t *from) {
+    struct ra_state_s *state = &states[first_block % RA_SLOTS];
+    uint32_t limit, n = 0;
+
+    pthread_mutex_lock(&ra_mutex);
+    if (!state->valid || state->first_block != first_block) {
+        state->valid = 1;
+        state->first_block = first_block;
+        state->next = 0;
+        state->ahead = 0;
+        state->window = 0;
+    }
+
+    /* O último bloco da leitura anterior pode ter ficado pela metade */
+    if (start == state->next || start + 1 == state->next) {
+        state->window = ra_grow(state->window);
+        ra_stats.sequential++;
+    } else {
+        state->window = 0;
+        state->ahead = 0;
+        ra_stats.random++;
+    }
+
+    state->next = end;
+    if (state->ahead < end) state->ahead = end;
+
+    limit = end + state->window < count ? end + state->window : count;
+    if (limit > state->ahead) n = limit - state->ahead;
+
+    *from = state->ahead;
+    state->ahead += n;
+    ra_stats.issued += n;
+    if (state->window > ra_stats.max_window) ra_stats.max_window = state->window;
+    pthread_mutex_unlock(&ra_mutex);
+    return n;
+}
+
+/* A cadeia foi removida ou encurtada: a posição guardada não vale mais */
+void ra_drop(uint32_t first_block) {
+    struct ra_state_s *state = &states[first_block % RA_SLOTS];
+
+    pthread_mutex_lock(&ra_mutex);
+    if (state->first_block == first_block) state->valid = 0;
+    pthread_mutex_unlock(&ra_mutex);
+}
+
+void ra_reset() {
+    pthread_mutex_lock(&ra_mutex);
+    for (int i = 0; i < RA_SLOTS; i++) {
+        states[i].valid = 0;
+    }
+    pthread_mutex_unlock(&ra_mutex);
+}
+
+void ra_print_stats() {
+    printf("Leitura antecipada: %llu acessos sequenciais, %llu aleatórios, %llu blocos pedidos, janela máxima %u\n",
+           (unsigned long long)ra_stats.sequential, (unsigned long long)ra_stats.random,
+           (unsigned long long)ra_stats.issued, ra_stats.max_window);
+}
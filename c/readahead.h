@@ -0,0 +1,29 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <stdint.h>
+
+#define RA_SLOTS          64
+#define RA_MIN_BLOCKS     4
+#define RA_MAX_BLOCKS     256
+
+/*
+ * Leitura antecipada adaptativa: cada arquivo guarda onde terminou a última
+ * leitura. Leituras que continuam dali dobram a janela; uma leitura fora de
+ * sequência a zera.
+ */
+struct ra_stats_s {
+    uint64_t sequential;
+    uint64_t random;
+    uint64_t issued;
+    uint32_t max_window;
+};
+extern struct ra_stats_s ra_stats;
+
+uint32_t ra_grow(uint32_t window);
+uint32_t ra_next(uint32_t first_block, uint32_t start, uint32_t end, uint32_t count, uint32_t *from);
+void ra_drop(uint32_t first_block);
+void ra_reset();
+void ra_print_stats();
+
+#endif
@@ -0,0 +1,388 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "filesystem.h"
+#include "device.h"
+#include "alloc.h"
+#include "locks.h"
+#include "snapshot.h"
+
+#define INDEX_ENTRIES (FAT_ENTRIES_PER_BLOCK - 1)
+
+/* Vetor que cresce conforme a árvore é percorrida */
+struct list_s {
+    uint32_t *items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+/* Estado de snapshot_create */
+struct build_s {
+    struct list_s chains;       /* cadeias alocadas na FAT viva, liberadas no fim */
+    struct list_s patches;      /* pares (bloco, valor) aplicados à FAT congelada */
+    struct list_s queue;        /* pares (diretório, cópia) ainda por copiar */
+};
+
+static struct snapshot_s table[SNAPSHOT_MAX];
+/* Por bloco, quantas FATs congeladas o marcam como ocupado */
+static uint8_t *refs = NULL;
+static uint32_t refs_blocks = 0;
+
+static int push(struct list_s *list, uint32_t value) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? 2 * list->capacity : 64;
+        uint32_t *grown = realloc(list->items, capacity * sizeof(uint32_t));
+        if (!grown) {
+            printf("Erro: Memória insuficiente para o snapshot.\n");
+            return -1;
+        }
+        list->items = grown;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = value;
+    return 0;
+}
+
+static int valid_block(uint32_t block) {
+    return block > ROOT_BLOCK && block < BLOCKS;
+}
+
+static uint32_t chain_length(uint32_t block) {
+    uint32_t length = 0;
+
+    while (block < BLOCKS && length < BLOCKS) {
+        length++;
+        block = fat[block];
+    }
+    return length;
+}
+
+static void write_table() {
+    dev_pwrite(table, sizeof(table), SNAPSHOT_TABLE_OFFSET);
+    dev_sync();
+}
+
+static struct snapshot_s *find(const char *name) {
+    for (int i = 0; i < SNAPSHOT_MAX; i++) {
+        if (table[i].index && strncmp(table[i].name, name, SNAPSHOT_NAME_SIZE) == 0) return &table[i];
+    }
+    return NULL;
+}
+
+/* Lê a FAT congelada do snapshot em frozen (FAT_BLOCKS blocos) */
+static int read_frozen(const struct snapshot_s *snap, uint32_t *frozen) {
+    uint32_t *storage = malloc((size_t)FAT_BLOCKS * sizeof(uint32_t));
+    uint32_t *index = malloc(BLOCK_SIZE);
+    uint32_t block = snap->index, count = 0;
+    int bad = !storage || !index;
+
+    while (!bad && count < FAT_BLOCKS) {
+        if (!valid_block(block)) {
+            bad = 1;
+            break;
+        }
+        read_block(block, (uint8_t *)index);
+        for (uint32_t i = 1; i <= INDEX_ENTRIES && count < FAT_BLOCKS && !bad; i++) {
+            bad = !valid_block(index[i]);
+            storage[count++] = index[i];
+        }
+        block = index[0];
+    }
+
+    if (!bad) read_chain(storage, count, (uint8_t *)frozen);
+    free(storage);
+    free(index);
+    return bad ? -1 : 0;
+}
+
+/* Referências zeradas e sem snapshots, com o tamanho da geometria atual */
+int snapshot_reset() {
+    if (refs_blocks != BLOCKS) {
+        uint8_t *new_refs = calloc(BLOCKS, 1);
+        if (!new_refs) {
+            printf("Erro: Memória insuficiente para %u blocos.\n", BLOCKS);
+            return -1;
+        }
+        free(refs);
+        refs = new_refs;
+        refs_blocks = BLOCKS;
+    } else {
+        memset(refs, 0, refs_blocks);
+    }
+    memset(table, 0, sizeof(table));
+    return 0;
+}
+
+/* Lê a tabela e refaz as referências; chamar antes de free_map_build */
+void snapshot_load() {
+    uint32_t *frozen = malloc((size_t)FAT_BLOCKS * BLOCK_SIZE);
+
+    dev_pread(table, sizeof(table), SNAPSHOT_TABLE_OFFSET);
+    for (int i = 0; i < SNAPSHOT_MAX; i++) {
+        if (!table[i].index) continue;
+        table[i].name[SNAPSHOT_NAME_SIZE - 1] = '\0';
+
+        if (!frozen || read_frozen(&table[i], frozen) == -1) {
+            printf("Erro: Snapshot '%s' ilegível; ignorado nesta carga.\n", table[i].name);
+            memset(&table[i], 0, sizeof(table[i]));
+            continue;
+        }
+        for (uint32_t b = ROOT_BLOCK + 1; b < BLOCKS; b++) {
+            if (frozen[b] != FAT_FREE) refs[b]++;
+        }
+    }
+    free(frozen);
+}
+
+int snapshot_shared(uint32_t block) {
+    return block < refs_blocks && refs[block];
+}
+
+uint32_t snapshot_count() {
+    uint32_t count = 0;
+
+    for (int i = 0; i < SNAPSHOT_MAX; i++) {
+        count += table[i].index != 0;
+    }
+    return count;
+}
+
+/* Copia o primeiro bloco de count arquivos, um lote por vez */
+static void copy_heads(const uint32_t *heads, const uint32_t *copies, uint32_t count) {
+    uint8_t *data = malloc(CHAIN_BATCH_BYTES);
+
+    for (uint32_t i = 0; data && i < count; i += CHAIN_BATCH) {
+        uint32_t n = count - i < CHAIN_BATCH ? count - i : CHAIN_BATCH;
+
+        read_chain(&heads[i], n, data);
+        write_chain(&copies[i], n, data, NULL);
+    }
+    free(data);
+}
+
+/*
+ * Grava em copy (cadeia já alocada, do mesmo tamanho) as entradas de dir.
+ * Cada arquivo ganha uma cópia do primeiro bloco, que na FAT congelada
+ * continua no segundo bloco do original; cada subdiretório ganha uma
+ * cadeia nova e entra na fila.
+ */
+static int copy_directory(uint32_t dir, uint32_t copy, struct build_s *build) {
+    uint32_t length = chain_length(dir);
+    uint32_t *blocks = malloc((size_t)length * sizeof(uint32_t));
+    uint32_t *copies = malloc((size_t)length * sizeof(uint32_t));
+    struct dir_entry_s *entries = malloc((size_t)length * BLOCK_SIZE);
+    struct list_s heads = {0}, head_copies = {0};
+    uint32_t total = length * DIR_ENTRIES, files = 0;
+    int head = -1, status = -1;
+
+    if (!blocks || !copies || !entries) {
+        printf("Erro: Memória insuficiente para o snapshot.\n");
+        goto out;
+    }
+    chain_blocks(dir, blocks, length);
+    chain_blocks(copy, copies, length);
+    read_chain(blocks, length, (uint8_t *)entries);
+
+    for (uint32_t i = 0; i < length; i++) {
+        if (blocks[i] > ROOT_BLOCK && (push(&build->patches, blocks[i]) == -1 ||
+                                       push(&build->patches, FAT_FREE) == -1)) goto out;
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        files += entries[i].attributes == 0x01 && valid_block(entries[i].first_block);
+    }
+    if (files > 0) {
+        if ((head = allocate_blocks(files)) == -1 || push(&build->chains, head) == -1) goto out;
+    }
+
+    for (uint32_t i = 0; i < total; i++) {
+        struct dir_entry_s *entry = &entries[i];
+        uint32_t original = entry->first_block;
+
+        if ((entry->attributes != 0x01 && entry->attributes != 0x02) || !valid_block(original)) continue;
+
+        if (entry->attributes == 0x02) {
+            int sub = allocate_blocks(chain_length(original));
+            if (sub == -1 || push(&build->chains, sub) == -1 ||
+                push(&build->queue, original) == -1 || push(&build->queue, sub) == -1) goto out;
+            entry->first_block = sub;
+            continue;
+        }
+
+        if (push(&heads, original) == -1 || push(&head_copies, head) == -1 ||
+            push(&build->patches, head) == -1 || push(&build->patches, fat[original]) == -1 ||
+            push(&build->patches, original) == -1 || push(&build->patches, FAT_FREE) == -1) goto out;
+        entry->first_block = head;
+        head = fat[head];
+    }
+
+    copy_heads(heads.items, head_copies.items, heads.count);
+    write_chain(copies, length, (const uint8_t *)entries, NULL);
+    status = 0;
+
+out:
+    free(blocks);
+    free(copies);
+    free(entries);
+    free(heads.items);
+    free(head_copies.items);
+    return status;
+}
+
+/*
+ * Congela a imagem viva sob name. O custo é o dos metadados: a FAT, os
+ * diretórios e um bloco por arquivo; os dados não são copiados. Uma queda
+ * antes da gravação da tabela deixa só blocos livres.
+ */
+int snapshot_create(const char *name) {
+    struct build_s build = { {0}, {0}, {0} };
+    struct snapshot_s *slot = NULL;
+    uint32_t *frozen = NULL, *storage = NULL, *index = NULL;
+    uint32_t index_blocks = (FAT_BLOCKS + INDEX_ENTRIES - 1) / INDEX_ENTRIES;
+    int root, first, status = -1;
+
+    if (name[0] == '\0' || strlen(name) >= SNAPSHOT_NAME_SIZE) {
+        printf("Erro: Nome de snapshot inválido (até %d caracteres).\n", SNAPSHOT_NAME_SIZE - 1);
+        return -1;
+    }
+
+    ns_lock_write();
+    if (find(name)) {
+        printf("Erro: Já existe um snapshot com o nome '%s'.\n", name);
+        goto out;
+    }
+    for (int i = 0; i < SNAPSHOT_MAX && !slot; i++) {
+        if (!table[i].index) slot = &table[i];
+    }
+    if (!slot) {
+        printf("Erro: Limite de %d snapshots atingido.\n", SNAPSHOT_MAX);
+        goto out;
+    }
+
+    /* O snapshot parte de uma imagem descarregada */
+    flush_filesystem();
+
+    root = allocate_blocks(chain_length(ROOT_BLOCK));
+    if (root == -1 || push(&build.chains, root) == -1 ||
+        push(&build.queue, ROOT_BLOCK) == -1 || push(&build.queue, root) == -1) goto out;
+    for (uint32_t q = 0; q < build.queue.count; q += 2) {
+        if (copy_directory(build.queue.items[q], build.queue.items[q + 1], &build) == -1) goto out;
+    }
+
+    /* Blocos de índice e, depois deles, os da FAT congelada */
+    first = allocate_blocks(index_blocks + FAT_BLOCKS);
+    if (first == -1 || push(&build.chains, first) == -1) goto out;
+    storage = malloc((size_t)(index_blocks + FAT_BLOCKS) * sizeof(uint32_t));
+    index = calloc(index_blocks, BLOCK_SIZE);
+    frozen = malloc((size_t)FAT_BLOCKS * BLOCK_SIZE);
+    if (!storage || !index || !frozen) {
+        printf("Erro: Memória insuficiente para o snapshot.\n");
+        goto out;
+    }
+    chain_blocks(first, storage, index_blocks + FAT_BLOCKS);
+
+    /* Com as alocações acima: os blocos novos ficam ocupados na FAT congelada */
+    memcpy(frozen, fat, (size_t)FAT_BLOCKS * BLOCK_SIZE);
+    frozen[ROOT_BLOCK] = FAT_EOF;
+    for (uint32_t i = 0; i < build.patches.count; i += 2) {
+        frozen[build.patches.items[i]] = build.patches.items[i + 1];
+    }
+
+    for (uint32_t i = 0; i < index_blocks; i++) {
+        index[i * FAT_ENTRIES_PER_BLOCK] = i + 1 < index_blocks ? storage[i + 1] : FAT_EOF;
+    }
+    for (uint32_t i = 0; i < FAT_BLOCKS; i++) {
+        index[(i / INDEX_ENTRIES) * FAT_ENTRIES_PER_BLOCK + 1 + i % INDEX_ENTRIES] = storage[index_blocks + i];
+    }
+    write_chain(&storage[index_blocks], FAT_BLOCKS, (const uint8_t *)frozen, NULL);
+    write_chain(storage, index_blocks, (const uint8_t *)index, NULL);
+    dev_datasync();
+
+    strcpy(slot->name, name);
+    slot->index = storage[0];
+    slot->root = root;
+    write_table();
+
+    for (uint32_t b = ROOT_BLOCK + 1; b < BLOCKS; b++) {
+        if (frozen[b] != FAT_FREE) refs[b]++;
+    }
+    status = 0;
+
+out:
+    /* Na FAT viva as cópias voltam a ser livres; as referências as seguram */
+    for (uint32_t i = 0; i < build.chains.count; i++) {
+        free_chain(build.chains.items[i]);
+    }
+    ns_unlock();
+
+    free(build.chains.items);
+    free(build.patches.items);
+    free(build.queue.items);
+    free(frozen);
+    free(storage);
+    free(index);
+    return status;
+}
+
+/* Remove o snapshot; blocos que só ele usava e estão livres na FAT viva voltam ao mapa */
+int snapshot_delete(const char *name) {
+    uint32_t *frozen = malloc((size_t)FAT_BLOCKS * BLOCK_SIZE);
+    struct snapshot_s *snap;
+    int readable;
+
+    ns_lock_write();
+    snap = find(name);
+    if (!snap) {
+        ns_unlock();
+        free(frozen);
+        printf("Erro: Snapshot '%s' não encontrado.\n", name);
+        return -1;
+    }
+
+    readable = frozen && read_frozen(snap, frozen) == 0;
+    memset(snap, 0, sizeof(*snap));
+    write_table();
+
+    for (uint32_t b = ROOT_BLOCK + 1; readable && b < BLOCKS; b++) {
+        if (frozen[b] == FAT_FREE || !refs[b] || --refs[b]) continue;
+
+        alloc_group_lock(b);
+        if (fat[b] == FAT_FREE) free_map_update(b, 1);
+        alloc_group_unlock(b);
+    }
+    ns_unlock();
+
+    free(frozen);
+    if (!readable) printf("Erro: Snapshot ilegível; seus blocos só voltam a ficar livres na próxima carga.\n");
+    return 0;
+}
+
+/* Troca a FAT em memória pela do snapshot; devolve a raiz dele ou -1 */
+int snapshot_mount(const char *name) {
+    struct snapshot_s *snap = find(name);
+
+    if (!snap) {
+        printf("Erro: Snapshot '%s' não encontrado.\n", name);
+        return -1;
+    }
+    if (read_frozen(snap, fat) == -1) {
+        printf("Erro: Snapshot '%s' ilegível.\n", name);
+        return -1;
+    }
+    return snap->root;
+}
+
+void snapshot_list() {
+    uint32_t shared = 0;
+
+    ns_lock_read();
+    for (uint32_t b = 0; b < refs_blocks; b++) {
+        shared += refs[b] != 0;
+    }
+    printf("Snapshots: %u de %d, %u blocos retidos\n", snapshot_count(), SNAPSHOT_MAX, shared);
+    for (int i = 0; i < SNAPSHOT_MAX; i++) {
+        if (table[i].index) printf("%s - raiz no bloco %u\n", table[i].name, table[i].root);
+    }
+    ns_unlock();
+}
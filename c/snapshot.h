@@ -0,0 +1,38 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAX          8
+#define SNAPSHOT_NAME_SIZE    24
+#define SNAPSHOT_TABLE_OFFSET 64     /* no bloco 0, logo após o superbloco */
+
+/*
+ * Snapshot: uma FAT congelada e cópias dos diretórios e do primeiro bloco
+ * de cada arquivo; os demais blocos de dados são compartilhados com a
+ * imagem viva. A FAT congelada fica em blocos comuns listados por blocos
+ * de índice ([0] = próximo índice ou FAT_EOF, depois os blocos da FAT).
+ *
+ * Na FAT viva esses blocos podem estar livres: o contador de referências
+ * de cada bloco (quantas FATs congeladas o marcam como ocupado) os mantém
+ * fora do mapa de livres, e quem vai regravar um bloco compartilhado
+ * troca-o antes por um novo. As referências não são gravadas: a carga as
+ * refaz a partir das FATs congeladas.
+ */
+struct snapshot_s {
+    char name[SNAPSHOT_NAME_SIZE];
+    uint32_t index;     /* primeiro bloco de índice; 0 = vaga livre */
+    uint32_t root;      /* cópia do diretório raiz */
+};
+
+int snapshot_reset();
+void snapshot_load();
+int snapshot_shared(uint32_t block);
+uint32_t snapshot_count();
+
+int snapshot_create(const char *name);
+int snapshot_delete(const char *name);
+int snapshot_mount(const char *name);
+void snapshot_list();
+
+#endif
@@ -0,0 +1,135 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+/* Relógio dos comandos, do modo batch e do bench; existe mesmo sem estatísticas */
+uint64_t stat_now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+#ifndef FILESYSTEM_NO_STATS
+
+/* Índice 0: tudo o que não é um dos comandos abaixo */
+static const char *op_names[STAT_OPS] = {
+    "outros", "ls", "mkdir", "create", "unlink", "write", "append", "truncate",
+    "import", "read", "sync", "export", "fsck", "init", "load", "snapshot",
+    "(descarga)", NULL
+};
+
+static const char *counter_names[STAT_COUNTERS] = {
+    "read_block", "write_block", "blocos lidos em cadeia", "blocos gravados em cadeia",
+    "entradas da FAT", "setores da FAT", "consultas a diretório", "índices montados",
+    "alocações", "grupos visitados"
+};
+
+_Atomic uint64_t stat_counters[STAT_OPS][STAT_COUNTERS];
+_Thread_local int stat_op = 0;
+static _Atomic uint64_t histogram[STAT_OPS][STAT_BUCKETS];
+static _Atomic uint64_t total_ns[STAT_OPS];
+
+/* Passa a contar para o comando da linha; devolve o índice para stat_end */
+int stat_begin(const char *command) {
+    size_t length = strcspn(command, " \t\r\n");
+
+    stat_op = 0;
+    for (int i = 1; i < STAT_OPS && op_names[i]; i++) {
+        if (strlen(op_names[i]) == length && strncmp(command, op_names[i], length) == 0) {
+            stat_op = i;
+            break;
+        }
+    }
+    return stat_op;
+}
+
+void stat_end(int op, uint64_t start) {
+    uint64_t elapsed = stat_now() - start;
+    int bucket = elapsed ? 63 - __builtin_clzll(elapsed) : 0;
+
+    if (bucket >= STAT_BUCKETS) bucket = STAT_BUCKETS - 1;
+    atomic_fetch_add_explicit(&histogram[op][bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&total_ns[op], elapsed, memory_order_relaxed);
+    stat_op = 0;
+}
+
+void stat_reset() {
+    for (int op = 0; op < STAT_OPS; op++) {
+        for (int i = 0; i < STAT_COUNTERS; i++) {
+            atomic_store(&stat_counters[op][i], 0);
+        }
+        for (int i = 0; i < STAT_BUCKETS; i++) {
+            atomic_store(&histogram[op][i], 0);
+        }
+        atomic_store(&total_ns[op], 0);
+    }
+}
+
+/* Limite superior do balde em texto curto: 512ns, 64us, 2ms... */
+static void format_bound(int bucket, char *text, size_t size) {
+    double bound = (double)((uint64_t)2 << bucket);
+
+    if (bound < 1e3) snprintf(text, size, "%.0fns", bound);
+    else if (bound < 1e6) snprintf(text, size, "%.0fus", bound / 1e3);
+    else if (bound < 1e9) snprintf(text, size, "%.0fms", bound / 1e6);
+    else snprintf(text, size, "%.0fs", bound / 1e9);
+}
+
+/* Balde em que cai a fração q das chamadas */
+static int quantile(const uint64_t *buckets, uint64_t count, double q) {
+    uint64_t seen = 0;
+
+    for (int i = 0; i < STAT_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen > 0 && seen >= q * count) return i;
+    }
+    return STAT_BUCKETS - 1;
+}
+
+void stat_print() {
+    char p50[16], p99[16], bound[16];
+
+    for (int op = 0; op < STAT_OPS && op_names[op]; op++) {
+        uint64_t buckets[STAT_BUCKETS], count = 0, counters[STAT_COUNTERS], any = 0;
+
+        for (int i = 0; i < STAT_BUCKETS; i++) {
+            buckets[i] = atomic_load(&histogram[op][i]);
+            count += buckets[i];
+        }
+        for (int i = 0; i < STAT_COUNTERS; i++) {
+            counters[i] = atomic_load(&stat_counters[op][i]);
+            any |= counters[i];
+        }
+        if (count == 0 && any == 0) continue;
+
+        printf("%s:", op_names[op]);
+        if (count > 0) {
+            format_bound(quantile(buckets, count, 0.5), p50, sizeof(p50));
+            format_bound(quantile(buckets, count, 0.99), p99, sizeof(p99));
+            printf(" %llu vezes, média %.1f us, p50 <= %s, p99 <= %s",
+                   (unsigned long long)count, atomic_load(&total_ns[op]) / 1e3 / count, p50, p99);
+        }
+        printf("\n");
+
+        for (int i = 0; i < STAT_COUNTERS; i++) {
+            if (counters[i] == 0) continue;
+            printf("  %s: %llu", counter_names[i], (unsigned long long)counters[i]);
+            if (count > 0) printf(" (%.1f por comando)", (double)counters[i] / count);
+            printf("\n");
+        }
+        if (count > 0) {
+            printf("  latência:");
+            for (int i = 0; i < STAT_BUCKETS; i++) {
+                if (buckets[i] == 0) continue;
+                format_bound(i, bound, sizeof(bound));
+                printf(" <=%s:%llu", bound, (unsigned long long)buckets[i]);
+            }
+            printf("\n");
+        }
+    }
+}
+#endif
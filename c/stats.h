@@ -0,0 +1,49 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Instrumentação dos caminhos quentes: contadores por comando e histograma
+ * de latência em potências de 2 (nanossegundos). O comando em curso é da
+ * thread; o que acontece fora de um comando (threads de E/S, replay) conta
+ * como "outros". Com -DFILESYSTEM_NO_STATS as macros somem.
+ */
+enum stat_counter_e {
+    STAT_READ_BLOCK,
+    STAT_WRITE_BLOCK,
+    STAT_CHAIN_READ,        /* blocos lidos por read_chain */
+    STAT_CHAIN_WRITE,       /* blocos gravados por write_chain */
+    STAT_FAT_SET,
+    STAT_FAT_SECTOR,
+    STAT_DIR_PROBE,         /* blocos de diretório consultados pelo índice */
+    STAT_DIR_INDEX_BUILD,
+    STAT_ALLOC,
+    STAT_ALLOC_GROUP,       /* grupos travados pelas alocações */
+    STAT_COUNTERS
+};
+
+#define STAT_OPS     18
+#define STAT_BUCKETS 40     /* até 2^40 ns, uns 18 minutos */
+
+uint64_t stat_now();
+
+#ifndef FILESYSTEM_NO_STATS
+extern _Atomic uint64_t stat_counters[STAT_OPS][STAT_COUNTERS];
+extern _Thread_local int stat_op;
+
+int stat_begin(const char *command);
+void stat_end(int op, uint64_t start);
+void stat_reset();
+void stat_print();
+
+#define STAT_ADD(counter, n) \
+    atomic_fetch_add_explicit(&stat_counters[stat_op][counter], (n), memory_order_relaxed)
+#define STAT_INC(counter) STAT_ADD(counter, 1)
+#else
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_INC(counter)    ((void)0)
+#endif
+
+#endif